@@ -0,0 +1,34 @@
+import FLNV.Expression
+import FLNV.Reader
+import FLNV.AST
+import FLNV.Bytecode
+import FLNV.Error
+import System.IO
+import System.Exit
+import qualified Data.ByteString.Lazy.Char8 as L
+
+runParser :: L.ByteString -> IO Expression
+runParser str = case (readProgram "stdin" str :: Either Error Expression) of
+                  Right expr -> return expr
+                  Left err -> do hPutStrLn stderr (show err)
+                                 exitWith $ ExitFailure 1
+
+doDesugar :: Expression -> IO AST
+doDesugar exp = do case (runDesugar $ desugar exp) of
+                     (Left err) -> do hPutStrLn stderr (show err)
+                                      exitWith $ ExitFailure 2
+                     (Right ast) -> return ast
+
+doCompile :: AST -> IO String
+doCompile ast = case compileBytecode ast of
+                  Left err -> do hPutStrLn stderr (show err)
+                                 exitWith $ ExitFailure 3
+                  Right image -> return image
+
+main :: IO ()
+main = do prog <- L.getContents
+          expr <- runParser prog
+          ast  <- doDesugar expr
+          image <- doCompile ast
+          putStr image
+          exitWith ExitSuccess
@@ -3,5 +3,6 @@ module FLNV where
 import FLNV.Asm
 import FLNV.Expression
 import FLNV.Parser
+import FLNV.Reader
 import FLNV.Error
 import FLNV.AST
@@ -1,4 +1,4 @@
-module FLNV.AST (AST(..), desugar, Desugar, runDesugar) where
+module FLNV.AST (AST(..), desugar, Desugar, runDesugar, isFixnum) where
 
 import FLNV.Env
 import FLNV.Error
@@ -7,6 +7,11 @@ import Control.Monad
 import Control.Monad.State
 import Control.Monad.Error hiding (Error)
 
+-- Whether n fits in a fixnum: 30 bits, as FIXNUM_MIN and FIXNUM_MAX in
+-- gc.h. Integers outside this range can't be represented at runtime.
+isFixnum :: Integer -> Bool
+isFixnum n = n >= -(2^29) && n < 2^29
+
 -- An AST is approximately an Expression, but it makes special forms
 -- and calls explicit. Syntax checking occurs during the translation
 -- from Expression to AST
@@ -19,6 +24,22 @@ data AST = Lambda [String] AST
          | Quoted Expression
          | Sequence [AST]
          | AVar String
+         -- Produced by FLNV.Optimize from directly applied lambdas:
+         -- local bindings, evaluated in order in the enclosing scope.
+         | Let [(String, AST)] AST
+         -- Produced by closure conversion (FLNV.Closure): a closure
+         -- over the given captured variables, and resolved references
+         -- to arguments, captured variables, globals, and variables
+         -- bound by a Let in the same procedure.
+         | Closure Int [AST] AST
+         | LocalRef Int
+         | FreeRef Int
+         | GlobalRef String
+         | BoundRef String
+         -- Produced by escape analysis (FLNV.Escape): a Closure or a
+         -- call to cons whose result doesn't outlive the current
+         -- procedure call, and so can be allocated in its frame.
+         | StackAlloc AST
            deriving Show
 
 type DesugarEnv = Env ()
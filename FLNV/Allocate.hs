@@ -0,0 +1,88 @@
+module FLNV.Allocate (allocateRegisters, allocatable) where
+
+import FLNV.Asm
+import FLNV.IR
+import Data.List
+import Data.Ord
+
+-- Linear-scan register allocation (Poletto and Sarkar) of the
+-- temporaries in a procedure body.
+--
+-- Code within a procedure only ever jumps forwards, except for the
+-- out-of-line paths, which use no temporaries of their own and jump
+-- back to where they left off. So a temporary is live from the first
+-- instruction that mentions it to the last, with no need for a
+-- dataflow pass.
+--
+-- Temporaries hold handles, which the collector must be able to find
+-- and relocate at every Safepoint. Those that don't get a register
+-- live in a slot in the current frame, on the SICP stack, where the
+-- collector scans them. Those that do are saved to a slot of their
+-- own around each Safepoint they are live across, and reloaded after
+-- it. The frame's slots are the root map for its temporaries: the
+-- caller of allocateRegisters reserves them and clears them to nil on
+-- entry, so they hold valid handles whenever the collector looks.
+
+-- Registers that the compiler never names directly. We can't keep
+-- handles in the callee-saved %r15 across a call any more than the
+-- others, since the collector may move what they point to, but using
+-- it means flnv_entry must preserve it for its C caller.
+allocatable :: [Register]
+allocatable = [ESI, R8D, R9D, R10D, R11D, R15D]
+
+data Interval = Interval { temp :: Int, start :: Int, end :: Int }
+
+data Home = InRegister Register
+          | InSlot Integer
+
+intervals :: [IR] -> [Interval]
+intervals ir = sortBy (comparing start) $ map interval $
+               groupBy sameTemp $ sortBy (comparing fst) uses
+    where uses = [ (t, i) | (i, instr) <- zip [0..] ir, t <- temps instr ]
+          sameTemp a b = fst a == fst b
+          interval us  = Interval (fst $ head us) (minimum $ map snd us) (maximum $ map snd us)
+
+-- Assign registers in order of interval start. When none is free,
+-- spill whichever of the new interval and the active ones ends last.
+-- A temporary that gets spilled after all appears twice, and the
+-- later assignment is the one that counts.
+linearScan :: [Interval] -> [(Int, Home)]
+linearScan = scan [] allocatable 0
+    where scan _ _ _ [] = []
+          scan active free slots (i:is) =
+              let (expired, live) = partition ((< start i) . end . fst) active
+              in case map snd expired ++ free of
+                   r:rs -> (temp i, InRegister r) : scan (activate i r live) rs slots is
+                   []   -> let (j, r) = last live
+                           in if end j > end i
+                              then (temp j, InSlot slots) : (temp i, InRegister r)
+                                   : scan (activate i r $ init live) [] (slots + 1) is
+                              else (temp i, InSlot slots) : scan live [] (slots + 1) is
+          activate i r = insertBy (comparing (end . fst)) (i, r)
+
+-- Rewrite a body to use machine registers and frame slots, given the
+-- operand for each slot. Returns the code and the number of slots.
+allocateRegisters :: (Integer -> Operand) -> [IR] -> ([Instruction], Integer)
+allocateRegisters slot ir = (concat $ zipWith rewrite [0..] ir, spills + genericLength saved)
+    where ivs        = intervals ir
+          homes      = reverse $ linearScan ivs
+          home t     = maybe (error $ "allocateRegisters: no home for " ++ show t) id $ lookup t homes
+          spills     = genericLength [ () | (_, InSlot _) <- homes ]
+          safepoints = [ p | (p, Safepoint _) <- zip [0..] ir ]
+          crosses i p = start i < p && p < end i
+          saved      = zip [ temp i | i <- ivs, InRegister _ <- [home $ temp i],
+                                      any (crosses i) safepoints ]
+                           [spills ..]
+
+          rewrite _ (Instr instr) = [mapOperands operand instr]
+          rewrite p (Safepoint call) = map save live ++ call ++ map restore live
+              where live = [ (r, slot s) | i <- ivs, crosses i p,
+                                           InRegister r <- [home $ temp i],
+                                           Just s <- [lookup (temp i) saved] ]
+
+          operand (Temp t) = case home t of
+                               InRegister r -> Reg r
+                               InSlot s     -> slot s
+          operand o        = o
+          save (r, o)    = Mov LONG (Reg r) o
+          restore (r, o) = Mov LONG o (Reg r)
@@ -1,5 +1,7 @@
-module FLNV.Asm where
+module FLNV.Asm ( module FLNV.Asm.Registers
+                , module FLNV.Asm.Condition
+                , module FLNV.Asm.Instruction ) where
 
 import FLNV.Asm.Registers
 import FLNV.Asm.Condition
-
+import FLNV.Asm.Instruction
@@ -1,4 +1,4 @@
-module FLNV.Asm.Condition ( Condition(..), negateCondition) where
+module FLNV.Asm.Condition ( Condition(..), negateCondition, conditionName) where
 
 import Data.Array
 
@@ -20,6 +20,9 @@ instance Show Condition where
 negateCondition :: Condition -> Condition
 negateCondition = opsNegate . (conditionOps!)
 
+conditionName :: Condition -> String
+conditionName = opsName . (conditionOps!)
+
 
 {- Bookkeeping -}
 
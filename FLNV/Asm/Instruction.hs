@@ -0,0 +1,97 @@
+module FLNV.Asm.Instruction ( Operand(..), Instruction(..),
+                              operands, mapOperands ) where
+
+import FLNV.Asm.Registers
+import FLNV.Asm.Condition
+
+-- Instructions are printed in AT&T syntax, for consumption by gas.
+
+data Operand = Reg Register
+             | Imm Integer
+             | Mem Integer Register   -- disp(%reg)
+             | Abs String Integer     -- symbol+disp, as a memory reference
+             | Addr String            -- $symbol, the address as an immediate
+             | Temp Int               -- a virtual register (see FLNV.Allocate)
+
+instance Show Operand where
+    show (Reg r)   = registerName r
+    show (Imm n)   = '$' : show n
+    show (Mem 0 r) = "(" ++ registerName r ++ ")"
+    show (Mem d r) = show d ++ "(" ++ registerName r ++ ")"
+    show (Abs s 0) = s
+    show (Abs s d) = s ++ "+" ++ show d
+    show (Addr s)  = '$' : s
+    show (Temp t)  = "%t" ++ show t
+
+data Instruction = Label String
+                 | Directive String
+                 | Mov  Width Operand Operand
+                 | Lea  Operand Operand
+                 | Add  Width Operand Operand
+                 | Sub  Width Operand Operand
+                 | And  Width Operand Operand
+                 | Or   Width Operand Operand
+                 | Cmp  Width Operand Operand
+                 | Test Width Operand Operand
+                 | Jmp  Operand
+                 | J    Condition String
+                 | Call Operand
+                 | Ret
+                 | Push Operand
+                 | Pop  Operand
+
+instance Show Instruction where
+    show (Label l)      = l ++ ":"
+    show (Directive d)  = '\t' : d
+    show (Mov  w a b)   = binary "mov"  w a b
+    show (Lea  a b)     = binary "lea"  QUADWORD a b
+    show (Add  w a b)   = binary "add"  w a b
+    show (Sub  w a b)   = binary "sub"  w a b
+    show (And  w a b)   = binary "and"  w a b
+    show (Or   w a b)   = binary "or"   w a b
+    show (Cmp  w a b)   = binary "cmp"  w a b
+    show (Test w a b)   = binary "test" w a b
+    show (Jmp  t)       = "\tjmp " ++ target t
+    show (J c l)        = "\tj" ++ conditionName c ++ " " ++ l
+    show (Call t)       = "\tcall " ++ target t
+    show Ret            = "\tret"
+    show (Push o)       = "\tpush " ++ show o
+    show (Pop o)        = "\tpop " ++ show o
+
+operands :: Instruction -> [Operand]
+operands (Mov  _ a b) = [a, b]
+operands (Lea  a b)   = [a, b]
+operands (Add  _ a b) = [a, b]
+operands (Sub  _ a b) = [a, b]
+operands (And  _ a b) = [a, b]
+operands (Or   _ a b) = [a, b]
+operands (Cmp  _ a b) = [a, b]
+operands (Test _ a b) = [a, b]
+operands (Jmp  t)     = [t]
+operands (Call t)     = [t]
+operands (Push o)     = [o]
+operands (Pop o)      = [o]
+operands _            = []
+
+mapOperands :: (Operand -> Operand) -> Instruction -> Instruction
+mapOperands f (Mov  w a b) = Mov  w (f a) (f b)
+mapOperands f (Lea  a b)   = Lea  (f a) (f b)
+mapOperands f (Add  w a b) = Add  w (f a) (f b)
+mapOperands f (Sub  w a b) = Sub  w (f a) (f b)
+mapOperands f (And  w a b) = And  w (f a) (f b)
+mapOperands f (Or   w a b) = Or   w (f a) (f b)
+mapOperands f (Cmp  w a b) = Cmp  w (f a) (f b)
+mapOperands f (Test w a b) = Test w (f a) (f b)
+mapOperands f (Jmp  t)     = Jmp  (f t)
+mapOperands f (Call t)     = Call (f t)
+mapOperands f (Push o)     = Push (f o)
+mapOperands f (Pop o)      = Pop  (f o)
+mapOperands _ i            = i
+
+binary :: String -> Width -> Operand -> Operand -> String
+binary op w a b = '\t' : op ++ widthSuffix w ++ " " ++ show a ++ ", " ++ show b
+
+-- Direct jumps name their label; anything else is indirect.
+target :: Operand -> String
+target (Abs l 0) = l
+target o         = '*' : show o
@@ -1,5 +1,6 @@
-module FLNV.Asm.Registers ( Width(..), bitWidth,
-                            Register(..), registerWidth) where
+module FLNV.Asm.Registers ( Width(..), bitWidth, widthSuffix,
+                            Register(..), registerWidth, registerName,
+                            resizeRegister) where
 
 import Data.Array
 
@@ -13,6 +14,12 @@ bitWidth WORD = 16
 bitWidth LONG = 32
 bitWidth QUADWORD = 64
 
+widthSuffix :: Width -> String
+widthSuffix BYTE = "b"
+widthSuffix WORD = "w"
+widthSuffix LONG = "l"
+widthSuffix QUADWORD = "q"
+
 data Register = AL  | AH  | BL   | BH   | CL   | CH   | DL   | DH
               | R8B | R9B | R10B | R11B | R12B | R13B | R14B | R15B
               | SPL | BPL | DIL  | SIL
@@ -35,6 +42,19 @@ instance Show Register where
 registerWidth :: Register -> Width
 registerWidth = opsWidth . (regOps!)
 
+registerName :: Register -> String
+registerName = opsName . (regOps!)
+
+-- The view of the same general-purpose register at a different
+-- width. The byte registers aren't laid out in parallel with the
+-- rest, so we don't support them.
+resizeRegister :: Width -> Register -> Register
+resizeRegister w r = toEnum $ base w + (fromEnum r - base (registerWidth r))
+    where base WORD     = fromEnum AX
+          base LONG     = fromEnum EAX
+          base QUADWORD = fromEnum RAX
+          base BYTE     = error "resizeRegister: byte registers are irregular"
+
 {- Internal bookkeeping -}
 
 data RegOps = R String Width
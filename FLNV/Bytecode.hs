@@ -0,0 +1,262 @@
+module FLNV.Bytecode (compileBytecode) where
+
+import FLNV.AST
+import FLNV.Error
+import FLNV.Expression
+import FLNV.Closure
+import FLNV.Optimize
+import Control.Monad
+import Control.Monad.State
+import Control.Monad.Error hiding (Error)
+import Data.List
+import Data.Ord
+
+-- Compiles an AST to bytecode for the VM in vm.c, as an image that the
+-- C reader can load (see vm.h for the format). This is the same SICP
+-- compiler as FLNV.Compile, minus the register allocation and the
+-- object layouts, which the VM takes care of:
+--
+-- Each procedure's frame holds its arguments and then one slot for
+-- each variable bound by a Let in its body, all addressed by index.
+-- Operands are pushed on the stack, and the last one is left in val;
+-- calls take the procedure in val and the arguments on the stack.
+--
+-- Calls in tail position become tail-call, which reuses the frame, and
+-- any other expression in tail position is followed by return. Other
+-- calls start with frame, which pushes the return address.
+--
+-- Two-argument calls to the arithmetic and comparison primitives, and
+-- to cons, have instructions of their own. The arithmetic ones carry
+-- the primitive's global to fall back on, as in FLNV.Compile. So do
+-- record-ref and record-set! with a constant field index.
+
+data Operand = Int Integer
+             | Target String
+
+data Code = Op String [Operand]
+          | Label String
+
+data Procedure = Procedure Int Integer [Code]   -- arity, slots, code
+
+data BytecodeState = BytecodeState { nextLabel  :: Integer
+                                   , nextSlot   :: Integer
+                                   , bindings   :: [(String, Integer)]
+                                   , constants  :: [Expression]
+                                   , globals    :: [String]
+                                   , nextProc   :: Int
+                                   , procedures :: [(Int, Procedure)] }
+
+newtype Bytecode v = Bytecode (StateT BytecodeState (Either Error) v)
+    deriving (Monad, MonadError Error, MonadState BytecodeState)
+
+runBytecode :: Bytecode x -> Either Error x
+runBytecode (Bytecode c) = evalStateT c $ BytecodeState 0 0 [] [] [] 0 []
+
+newLabel :: String -> Bytecode String
+newLabel prefix = do s <- get
+                     put $ s { nextLabel = nextLabel s + 1 }
+                     return $ prefix ++ show (nextLabel s)
+
+newSlot :: Bytecode Integer
+newSlot = do s <- get
+             put $ s { nextSlot = nextSlot s + 1 }
+             return $ nextSlot s
+
+-- Compile with the given Let bindings in scope
+withBindings :: [(String, Integer)] -> Bytecode x -> Bytecode x
+withBindings bs c = do outer <- gets bindings
+                       modify $ \s -> s { bindings = bs }
+                       x <- c
+                       modify $ \s -> s { bindings = outer }
+                       return x
+
+-- Compile a procedure of the given arity, returning its index
+procedure :: Int -> Bytecode [Code] -> Bytecode Int
+procedure arity body = do s <- get
+                          let p = nextProc s
+                          put $ s { nextProc = p + 1, nextSlot = toInteger arity, bindings = [] }
+                          c <- body
+                          slots <- gets nextSlot
+                          modify $ \s' -> s' { nextSlot   = nextSlot s
+                                             , bindings   = bindings s
+                                             , procedures = (p, Procedure arity (slots - toInteger arity) c)
+                                                            : procedures s' }
+                          return p
+
+constant :: Expression -> Bytecode Integer
+constant e = do cs <- gets constants
+                case elemIndex e cs of
+                  Just i  -> return $ toInteger i
+                  Nothing -> do modify $ \s -> s { constants = cs ++ [e] }
+                                return $ genericLength cs
+
+global :: String -> Bytecode Integer
+global name = do gs <- gets globals
+                 case elemIndex name gs of
+                   Just i  -> return $ toInteger i
+                   Nothing -> do modify $ \s -> s { globals = gs ++ [name] }
+                                 return $ genericLength gs
+
+fixnum :: Integer -> Bytecode Integer
+fixnum n | isFixnum n = return n
+         | otherwise = throwError $ CompileError $
+                       "Integer literal out of fixnum range: " ++ show n
+
+quoted :: Expression -> Bytecode [Code]
+quoted (Number n)   = do n' <- fixnum n
+                         return [Op "fixnum" [Int n']]
+quoted (Bool True)  = return [Op "true" []]
+quoted (Bool False) = return [Op "false" []]
+quoted Nil          = return [Op "nil" []]
+quoted e            = do checkNumbers e
+                         i <- constant e
+                         return [Op "const" [Int i]]
+    where checkNumbers (Number n) = fixnum n >> return ()
+          checkNumbers (Cons a b) = checkNumbers a >> checkNumbers b
+          checkNumbers _          = return ()
+
+inlinePrimitives :: [(String, String)]
+inlinePrimitives = [ ("+", "add")
+                   , ("-", "sub")
+                   , ("<", "lt")
+                   , (">", "gt")
+                   , ("=", "num-eq") ]
+
+-- Record fields that the record instructions can reach, as for
+-- SC_RECORD_FAST_FIELDS in scgc.h
+fastField :: Integer -> Bool
+fastField i = i >= 0 && i < 32
+
+{- The compiler proper -}
+
+data Position = Tail
+              | NonTail
+
+-- An expression that leaves its value in val, returning it if need be
+value :: Position -> [Code] -> Bytecode [Code]
+value Tail    c = return $ c ++ [Op "return" []]
+value NonTail c = return c
+
+compile :: Position -> AST -> Bytecode [Code]
+compile p (ANumber n)       = do n' <- fixnum n
+                                 value p [Op "fixnum" [Int n']]
+compile p (ABool True)      = value p [Op "true" []]
+compile p (ABool False)     = value p [Op "false" []]
+compile p (AString s)       = do i <- constant $ String s
+                                 value p [Op "const" [Int i]]
+compile p (Quoted e)        = quoted e >>= value p
+compile _ (AVar v)          = throwError $ InternalError $ "Unresolved variable " ++ v
+compile p (LocalRef i)      = value p [Op "local" [Int $ toInteger i]]
+compile p (FreeRef i)       = value p [Op "free" [Int $ toInteger i]]
+compile p (BoundRef v)      = do bs <- gets bindings
+                                 case lookup v bs of
+                                   Just i  -> value p [Op "local" [Int i]]
+                                   Nothing -> throwError $ InternalError $ "Unbound Let variable " ++ v
+compile p (GlobalRef v)     = do g <- global v
+                                 value p [Op "global" [Int g]]
+compile p (Sequence [])     = value p [Op "nil" []]
+compile p (Sequence asts)   = do body <- mapM (compile NonTail) $ init asts
+                                 end  <- compile p $ last asts
+                                 return $ concat body ++ end
+compile Tail (If p c a)     = do pCode <- compile NonTail p
+                                 cCode <- compile Tail c
+                                 aCode <- compile Tail a
+                                 alt   <- newLabel "else"
+                                 return $ pCode
+                                          ++ [Op "jump-false" [Target alt]]
+                                          ++ cCode
+                                          ++ [Label alt]
+                                          ++ aCode
+compile NonTail (If p c a)  = do pCode <- compile NonTail p
+                                 cCode <- compile NonTail c
+                                 aCode <- compile NonTail a
+                                 alt   <- newLabel "else"
+                                 end   <- newLabel "endif"
+                                 return $ pCode
+                                          ++ [Op "jump-false" [Target alt]]
+                                          ++ cCode
+                                          ++ [Op "jump" [Target end], Label alt]
+                                          ++ aCode
+                                          ++ [Label end]
+compile p (Let binds body)  =
+    do valCode  <- mapM (compile NonTail . snd) binds
+       slots    <- mapM (const newSlot) binds
+       outer    <- gets bindings
+       bodyCode <- withBindings (zip (map fst binds) slots ++ outer) $ compile p body
+       return $ concat (zipWith (\c i -> c ++ [Op "set-local" [Int i]]) valCode slots)
+                ++ bodyCode
+compile _ (Lambda _ _)      = throwError $ InternalError "Lambda survived closure conversion"
+compile p (Closure arity captured body) =
+    do captures <- mapM (compile NonTail) captured
+       i        <- procedure arity $ compile Tail body
+       value p $ concatMap (++ [Op "push" []]) captures
+                 ++ [Op "closure" [Int $ toInteger i, Int $ genericLength captured]]
+compile p (Apply (GlobalRef f) [a, b])
+    | Just op <- lookup f inlinePrimitives = binary op . (:[]) . Int =<< global f
+    | f == "cons"                          = binary "cons" []
+    where binary op operands = do aCode <- compile NonTail a
+                                  bCode <- compile NonTail b
+                                  value p $ aCode ++ [Op "push" []] ++ bCode ++ [Op op operands]
+compile p (Apply (GlobalRef "record-ref") [t, r, ANumber i]) | fastField i =
+    do g     <- global "record-ref"
+       tCode <- compile NonTail t
+       rCode <- compile NonTail r
+       value p $ tCode ++ [Op "push" []] ++ rCode ++ [Op "record-ref" [Int i, Int g]]
+compile p (Apply (GlobalRef "record-set!") [t, r, ANumber i, x]) | fastField i =
+    do g     <- global "record-set!"
+       tCode <- compile NonTail t
+       rCode <- compile NonTail r
+       xCode <- compile NonTail x
+       value p $ tCode ++ [Op "push" []] ++ rCode ++ [Op "push" []] ++ xCode
+                 ++ [Op "record-set" [Int i, Int g]]
+compile Tail (Apply f args) = do c <- setupCall f args
+                                 return $ c ++ [Op "tail-call" [Int $ genericLength args]]
+compile NonTail (Apply f args) =
+    do c   <- setupCall f args
+       ret <- newLabel "return"
+       return $ [Op "frame" [Target ret]]
+                ++ c
+                ++ [Op "call" [Int $ genericLength args], Label ret]
+compile _ ast               = throwError $ InternalError $ "Can't compile " ++ show ast
+
+-- Push the arguments of a call, and leave the procedure in val
+setupCall :: AST -> [AST] -> Bytecode [Code]
+setupCall f args = do argCode <- mapM (compile NonTail) args
+                      fCode   <- compile NonTail f
+                      return $ concatMap (++ [Op "push" []]) argCode ++ fCode
+
+{- Program layout -}
+
+compileBytecode :: AST -> Either Error String
+compileBytecode ast = runBytecode $ do _      <- procedure 0 $ liftM (++ [Op "halt" []]) $
+                                                 compile NonTail $ closureConvert $ optimize ast
+                                       procs  <- gets procedures
+                                       consts <- gets constants
+                                       gs     <- gets globals
+                                       body   <- mapM (showProcedure . snd) $ sortBy (comparing fst) procs
+                                       return $ showString "(flnv-bytecode 1\n"
+                                                . section "constants" (map shows consts)
+                                                . section "globals" (map showString gs)
+                                                . foldr (.) id body
+                                                $ ")\n"
+    where section name xs = showString "  (" . showString name
+                            . foldr (\x r -> showChar ' ' . x . r) id xs
+                            . showString ")\n"
+
+-- Labels become word offsets within the procedure
+showProcedure :: Procedure -> Bytecode ShowS
+showProcedure (Procedure arity slots c) =
+    do ops <- mapM resolve [ (name, operands) | Op name operands <- c ]
+       return $ showString "  (procedure " . shows arity . showChar ' ' . shows slots
+                . foldr (.) id ops
+                . showString ")\n"
+    where offsets = snd $ mapAccumL layout 0 c
+          layout n (Label l)         = (n, Just (l, n))
+          layout n (Op _ operands)   = (n + 1 + genericLength operands, Nothing)
+          labels = [ x | Just x <- offsets ] :: [(String, Integer)]
+          resolve (name, operands) = do os <- mapM operand operands
+                                        return $ showString "\n    " . showString name
+                                                 . foldr (\o r -> showChar ' ' . shows o . r) id os
+          operand (Int n)    = return n
+          operand (Target l) = maybe (throwError $ InternalError $ "Undefined label " ++ l) return $
+                               lookup l labels
@@ -0,0 +1,47 @@
+module FLNV.Closure (closureConvert, freeVariables) where
+
+import FLNV.AST
+import Data.List
+
+-- Closure conversion. Every Lambda becomes a Closure which captures
+-- just the variables it uses from enclosing scopes, and every variable
+-- reference is resolved to a Let binding in the current procedure, an
+-- argument of it, one of its captured variables, or a global.
+closureConvert :: AST -> AST
+closureConvert = convert $ Scope [] [] []
+
+data Scope = Scope [String] [String] [String]  -- arguments, captured variables, Let bindings
+
+bound :: Scope -> String -> Bool
+bound (Scope args free lets) v = v `elem` lets || v `elem` args || v `elem` free
+
+reference :: Scope -> String -> AST
+reference (Scope args free lets) v
+    | v `elem` lets              = BoundRef v
+    | Just i <- elemIndex v args = LocalRef i
+    | Just i <- elemIndex v free = FreeRef i
+    | otherwise                  = GlobalRef v
+
+convert :: Scope -> AST -> AST
+convert s (AVar v)           = reference s v
+convert s l@(Lambda args body) =
+    Closure (length args) (map (reference s) captured)
+                (convert (Scope args captured []) body)
+    where captured = filter (bound s) $ freeVariables l
+convert s@(Scope args free lets) (Let binds body) =
+    Let [ (v, convert s e) | (v, e) <- binds ]
+        (convert (Scope args free $ map fst binds ++ lets) body)
+convert s (If p c a)         = If (convert s p) (convert s c) (convert s a)
+convert s (Apply f args)     = Apply (convert s f) (map (convert s) args)
+convert s (Sequence asts)    = Sequence $ map (convert s) asts
+convert _ ast                = ast
+
+freeVariables :: AST -> [String]
+freeVariables (AVar v)           = [v]
+freeVariables (Lambda args body) = freeVariables body \\ args
+freeVariables (If p c a)         = foldr (union . freeVariables) [] [p, c, a]
+freeVariables (Apply f args)     = foldr (union . freeVariables) [] (f:args)
+freeVariables (Sequence asts)    = foldr (union . freeVariables) [] asts
+freeVariables (Let binds body)   = foldr (union . freeVariables) (freeVariables body \\ map fst binds)
+                                         (map snd binds)
+freeVariables _                  = []
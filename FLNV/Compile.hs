@@ -0,0 +1,724 @@
+module FLNV.Compile (compileProgram) where
+
+import FLNV.AST
+import FLNV.Asm
+import FLNV.Error
+import FLNV.Expression
+import FLNV.Closure
+import FLNV.Optimize
+import FLNV.Escape
+import FLNV.IR
+import FLNV.Allocate
+import Control.Monad
+import Control.Monad.State
+import Control.Monad.Error hiding (Error)
+import Data.Char
+import Data.List
+import Data.Maybe
+
+-- Compiles an AST to x86-64 assembly, to be linked against the C
+-- runtime (gc.c, scgc.c, runtime.c). The generated code is a
+-- straightforward version of SICP's compiler:
+--
+-- The machine registers (see notes) are pinned to callee-saved
+-- registers, so they survive calls into C:
+--   env  %r12d    proc %ebx    val  %eax
+--   the SICP stack pointer lives in %r13 and grows upwards
+--   the current frame's arguments start at %r14
+--   continue is the hardware return address
+--
+-- The program is closure converted before we get here (see
+-- FLNV.Closure), so env holds the current procedure's closure, whose
+-- captured variables are its whole environment. Globals live in cells
+-- that the runtime fills in at startup.
+--
+-- Procedures are called with the closure in proc, the argument count
+-- in %ecx and the arguments on the SICP stack. The callee saves env
+-- just above its arguments and %r14 on the native stack, and returns
+-- with all of them popped and the result in val.
+--
+-- Calls in tail position reuse the caller's frame: the new arguments
+-- are moved down over the old ones, env and %r14 are restored, and we
+-- jump to the callee, which returns straight to our caller.
+--
+-- Fixnum arithmetic and comparisons are open-coded (see
+-- inlinePrimitives), falling back to a real call to the primitive when
+-- an operand is not a fixnum or the result overflows. So are record
+-- field accesses with a constant index (see checkRecord).
+--
+-- Intermediate values and the variables bound by Let go in
+-- temporaries, which FLNV.Allocate assigns to registers not otherwise
+-- used here, or to slots in the frame just above the saved env. So a
+-- frame on the SICP stack looks like
+--   args... env slots... [outgoing args...]
+--
+-- Closures and pairs that escape analysis (FLNV.Escape) shows don't
+-- outlive their procedure call are allocated in the runtime's region
+-- instead of the heap. A procedure that does so saves the region
+-- pointer on entry and resets it when it returns or makes a tail call.
+
+envReg, procReg, valReg, stackReg, frameReg :: Register
+envReg   = R12D
+procReg  = EBX
+valReg   = EAX
+stackReg = R13
+frameReg = R14
+
+{- Object layouts. These must agree with gc.h and scgc.c on x86-64 -}
+
+wordBytes, handleBytes :: Integer
+wordBytes   = 8
+handleBytes = 4
+
+tagMask, pointerTag, nilHandle :: Integer
+tagMask    = 3
+pointerTag = 2
+nilHandle  = 2
+
+-- GC_WORDS: the size in heap words of an object of n bytes
+gcWords :: Integer -> Integer
+gcWords n = (n + wordBytes - 1) `div` wordBytes
+
+-- sc_closure
+closureCode, closureSize, closureFree :: Integer
+closureCode = 8
+closureSize = 16
+closureFree = 20
+
+closureWords :: Integer -> Integer
+closureWords nfree = gcWords $ closureFree + nfree * handleBytes
+
+-- sc_cons
+consCar, consCdr, consWords :: Integer
+consCar   = 8
+consCdr   = 12
+consWords = gcWords 16
+
+-- sc_shape and sc_record
+shapeOps, shapeBitmap, recordFields :: Integer
+shapeOps     = 8
+shapeBitmap  = 48
+recordFields = 8
+
+-- SC_RECORD_FAST_FIELDS: the fields that checkRecord can vouch for
+fastField :: Integer -> Bool
+fastField i = i >= 0 && i < 32
+
+{- The compiler monad -}
+
+-- Constants are laid out in the executable as static objects where
+-- possible (see staticObject), and otherwise built by the runtime at
+-- startup from a table of descriptors (see rt_constant in runtime.h),
+-- in index order.
+data Constant = CImmediate Integer
+              | CBool Bool
+              | CSymbol String
+              | CString String
+              | CCons Int Int
+                deriving Eq
+
+data CompileState = CompileState { nextLabel  :: Integer
+                                 , nextTemp   :: Int
+                                 , bindings   :: [(String, Operand)]
+                                 , regionMark :: Maybe Operand
+                                 , constants  :: [Constant]
+                                 , globals    :: [String]
+                                 , procedures :: [Instruction] }
+
+newtype Compile v = Compile (StateT CompileState (Either Error) v)
+    deriving (Monad, MonadError Error, MonadState CompileState)
+
+runCompile :: Compile x -> Either Error x
+runCompile (Compile c) = evalStateT c $ CompileState 0 0 [] Nothing [] [] []
+
+newLabel :: String -> Compile String
+newLabel prefix = do s <- get
+                     put $ s { nextLabel = nextLabel s + 1 }
+                     return $ ".L" ++ prefix ++ show (nextLabel s)
+
+newTemp :: Compile Operand
+newTemp = do s <- get
+             put $ s { nextTemp = nextTemp s + 1 }
+             return $ Temp $ nextTemp s
+
+-- Compile with the given Let bindings in scope
+withBindings :: [(String, Operand)] -> Compile x -> Compile x
+withBindings bs c = do outer <- gets bindings
+                       modify $ \s -> s { bindings = bs }
+                       x <- c
+                       modify $ \s -> s { bindings = outer }
+                       return x
+
+-- Compile the body of a new procedure, which starts with no Let
+-- bindings in scope, and the given region mark if it allocates there
+inProcedure :: Maybe Operand -> Compile x -> Compile x
+inProcedure mark c = do s <- get
+                        put $ s { bindings = [], regionMark = mark }
+                        x <- c
+                        modify $ \s' -> s' { bindings = bindings s, regionMark = regionMark s }
+                        return x
+
+emitProcedure :: [Instruction] -> Compile ()
+emitProcedure code = modify $ \s -> s { procedures = procedures s ++ code }
+
+constant :: Constant -> Compile Int
+constant c = do consts <- gets constants
+                case elemIndex c consts of
+                  Just i  -> return i
+                  Nothing -> do modify $ \s -> s { constants = consts ++ [c] }
+                                return $ length consts
+
+quoted :: Expression -> Compile Int
+quoted (Symbol s) = constant $ CSymbol s
+quoted (String s) = constant $ CString s
+quoted (Bool b)   = constant $ CBool b
+quoted (Number n) = fixnum n >>= constant . CImmediate
+quoted Nil        = constant $ CImmediate nilHandle
+quoted (Cons a b) = do car <- quoted a
+                       cdr <- quoted b
+                       constant $ CCons car cdr
+
+constantRef :: Int -> Operand
+constantRef i = Abs "flnv_constants" $ handleBytes * toInteger i
+
+-- The first reference to a global also emits the out-of-line error
+-- path for when it turns out to be unbound.
+global :: String -> Compile Int
+global name = do gs <- gets globals
+                 case elemIndex name gs of
+                   Just i  -> return i
+                   Nothing -> do let i = length gs
+                                 modify $ \s -> s { globals = gs ++ [name] }
+                                 emitProcedure $ [ Label $ unboundLabel i
+                                                 , movl (Imm $ toInteger i) (Reg EDI) ]
+                                                 ++ callRuntime "rt_error_unbound"
+                                 return i
+
+globalRef :: Int -> Operand
+globalRef i = Abs "flnv_globals" $ handleBytes * toInteger i
+
+unboundLabel :: Int -> String
+unboundLabel i = ".Lunbound" ++ show i
+
+fixnum :: Integer -> Compile Integer
+fixnum n | isFixnum n = return $ (n * 4 + 1) `mod` 2^32
+         | otherwise = throwError $ CompileError $
+                       "Integer literal out of fixnum range: " ++ show n
+
+{- Instruction sequences -}
+
+movl, movq :: Operand -> Operand -> Instruction
+movl = Mov LONG
+movq = Mov QUADWORD
+
+push :: Register -> [Instruction]
+push r = [ movl (Reg r) (Mem 0 stackReg)
+         , Add QUADWORD (Imm handleBytes) (Reg stackReg) ]
+
+pop :: Register -> [Instruction]
+pop r = [ Sub QUADWORD (Imm handleBytes) (Reg stackReg)
+        , movl (Mem 0 stackReg) (Reg r) ]
+
+-- Call into the C runtime. The machine registers are spilled where
+-- the collector can find them, and %rsp is aligned for the ABI.
+callRuntime :: String -> [Instruction]
+callRuntime fn = [ movl (Reg envReg) (Abs "rt_env" 0)
+                 , movl (Reg procReg) (Abs "rt_proc" 0)
+                 , movq (Reg stackReg) (Abs "rt_sp" 0)
+                 , movq (Reg RSP) (Reg RBP)
+                 , And QUADWORD (Imm (-16)) (Reg RSP)
+                 , Call (Abs fn 0)
+                 , movq (Reg RBP) (Reg RSP)
+                 , movq (Abs "rt_sp" 0) (Reg stackReg)
+                 , movl (Abs "rt_env" 0) (Reg envReg)
+                 , movl (Abs "rt_proc" 0) (Reg procReg) ]
+
+-- Bump-allocate an object of the given number of words, leaving the
+-- untagged pointer in %rax. Clobbers %rdx, and everything else that
+-- the C ABI does if we have to fall back to the collector.
+allocate :: Integer -> Compile [IR]
+allocate words = do fast <- newLabel "alloc_fast"
+                    done <- newLabel "alloc_done"
+                    return $ code [ movq (Abs "free_ptr" 0) (Reg RAX)
+                                  , Lea (Mem (words * wordBytes) RAX) (Reg RDX)
+                                  , Cmp QUADWORD (Abs "heap_limit" 0) (Reg RDX)
+                                  , J BELOW_OR_EQUAL fast
+                                  , movl (Imm words) (Reg EDI) ]
+                             ++ [ Safepoint $ callRuntime "rt_alloc_slow" ]
+                             ++ code [ Jmp (Abs done 0)
+                                     , Label fast
+                                     , movq (Reg RDX) (Abs "free_ptr" 0)
+                                     , Label done ]
+
+-- Reserve the frame's slots for temporaries at the top of the stack,
+-- and clear them so that the collector can scan them.
+reserveSlots :: Integer -> [Instruction]
+reserveSlots 0 = []
+reserveSlots k = [ movl (Imm nilHandle) (Mem (i * handleBytes) stackReg) | i <- [0 .. k - 1] ]
+                 ++ [ Add QUADWORD (Imm $ k * handleBytes) (Reg stackReg) ]
+
+-- Allocate in the region, falling back on the heap when it's full
+allocateInRegion :: Integer -> Compile [IR]
+allocateInRegion words = do full     <- newLabel "region_full"
+                            done     <- newLabel "region_done"
+                            fallback <- allocate words
+                            return $ code [ movq (Abs "rt_region_ptr" 0) (Reg RAX)
+                                          , Lea (Mem (words * wordBytes) RAX) (Reg RDX)
+                                          , Cmp QUADWORD (Abs "rt_region_limit" 0) (Reg RDX)
+                                          , J ABOVE full
+                                          , movq (Reg RDX) (Abs "rt_region_ptr" 0)
+                                          , Jmp (Abs done 0)
+                                          , Label full ]
+                                     ++ fallback
+                                     ++ code [ Label done ]
+
+-- The region lives in the low 4GB, like the heap, so we can save its
+-- pointer tagged as a fixnum, which the collector leaves alone.
+markRegion :: Operand -> [Instruction]
+markRegion mark = [ movl (Abs "rt_region_ptr" 0) (Reg EDX)
+                  , Or LONG (Imm 1) (Reg EDX)
+                  , movl (Reg EDX) mark ]
+
+releaseRegion :: Operand -> [Instruction]
+releaseRegion mark = [ movl mark (Reg EDX)
+                     , Sub LONG (Imm 1) (Reg EDX)
+                     , movq (Reg RDX) (Abs "rt_region_ptr" 0) ]
+
+frameSlot :: Integer -> Integer -> Operand
+frameSlot base i = Mem ((base + i) * handleBytes) frameReg
+
+-- A constant whose handle is known at link time is an immediate
+-- operand; any other lives in its cell in flnv_constants.
+loadConstant :: Int -> Compile [Instruction]
+loadConstant i = do cs <- gets constants
+                    return [ movl (maybe (constantRef i) Addr $ constantHandle cs i) (Reg valReg) ]
+
+{- The compiler proper -}
+
+-- Whether an expression is in tail position in a procedure of the
+-- given arity, and so can hand that procedure's frame to a callee.
+data Position = Tail Integer
+              | NonTail
+
+compile :: Position -> AST -> Compile [IR]
+compile _ (ANumber n)     = do h <- fixnum n
+                               return $ code [movl (Imm h) (Reg valReg)]
+compile _ (ABool True)    = return $ code [movl (Abs "sc_true" 0) (Reg valReg)]
+compile _ (ABool False)   = return $ code [movl (Abs "sc_false" 0) (Reg valReg)]
+compile _ (AString s)     = liftM code $ constant (CString s) >>= loadConstant
+compile _ (Quoted e)      = liftM code $ quoted e >>= loadConstant
+compile _ (AVar v)        = throwError $ InternalError $ "Unresolved variable " ++ v
+compile _ r@(LocalRef _)  = liftM code $ fetch r valReg
+compile _ r@(FreeRef _)   = liftM code $ fetch r valReg
+compile _ r@(BoundRef _)  = liftM code $ fetch r valReg
+compile _ (GlobalRef v)   = do cell <- global v
+                               return $ code [ movl (globalRef cell) (Reg valReg)
+                                             , Test LONG (Reg valReg) (Reg valReg)
+                                             , J EQUAL $ unboundLabel cell ]
+compile _ (Sequence [])   = return $ code [movl (Imm nilHandle) (Reg valReg)]
+compile p (Sequence asts) = do body <- mapM (compile NonTail) $ init asts
+                               end  <- compile p $ last asts
+                               return $ concat body ++ end
+compile t (If p c a)      = do pCode <- compile NonTail p
+                               cCode <- compile t c
+                               aCode <- compile t a
+                               alt   <- newLabel "else"
+                               end   <- newLabel "endif"
+                               return $ pCode
+                                        ++ code [ Cmp LONG (Abs "sc_false" 0) (Reg valReg)
+                                                , J EQUAL alt ]
+                                        ++ cCode
+                                        ++ code [ Jmp (Abs end 0)
+                                                , Label alt ]
+                                        ++ aCode
+                                        ++ code [ Label end ]
+compile p (Let binds body) =
+    do valCode  <- mapM (compile NonTail . snd) binds
+       ts       <- mapM (const newTemp) binds
+       outer    <- gets bindings
+       bodyCode <- withBindings (zip (map fst binds) ts ++ outer) $ compile p body
+       return $ concat (zipWith (\c t -> c ++ code [movl (Reg valReg) t]) valCode ts)
+                ++ bodyCode
+compile _ (Lambda _ _)    = throwError $ InternalError "Lambda survived closure conversion"
+compile _ c@(Closure _ _ _) = build allocate c
+compile _ (StackAlloc e)    = build allocateInRegion e
+-- The slow path goes in a later subsection of .text, out of the way of
+-- the fast path, but the allocator sees it in place.
+compile _ (Apply (GlobalRef f) [a, b]) | Just op <- lookup f inlinePrimitives =
+    do aCode <- compile NonTail a
+       bCode <- compile NonTail b
+       t     <- newTemp
+       cell  <- global f
+       slow  <- newLabel "slow"
+       done  <- newLabel "done"
+       return $ aCode
+                ++ code [ movl (Reg valReg) t ]
+                ++ bCode
+                ++ code ([ movl t (Reg EDX)
+                         , movl (Reg EDX) (Reg ECX)
+                         , And LONG (Reg valReg) (Reg ECX)
+                         , Test LONG (Imm 1) (Reg ECX)
+                         , J EQUAL slow ]
+                         ++ inline op slow done
+                         ++ [ Label done
+                            , Directive ".subsection 1"
+                            , Label slow ]
+                         ++ push EDX
+                         ++ push valReg
+                         ++ [ movl (globalRef cell) (Reg procReg)
+                            , movl (Imm 2) (Reg ECX) ])
+                ++ [ Safepoint [Call (Abs "flnv_apply" 0)] ]
+                ++ code [ Jmp (Abs done 0)
+                        , Directive ".subsection 0" ]
+compile _ (Apply (GlobalRef "record-ref") [t, r, ANumber i]) | fastField i =
+    do tCode <- compile NonTail t
+       rCode <- compile NonTail r
+       shape <- newTemp
+       cell  <- global "record-ref"
+       index <- fixnum i
+       slow  <- newLabel "slow"
+       done  <- newLabel "done"
+       return $ tCode
+                ++ code [ movl (Reg valReg) shape ]
+                ++ rCode
+                ++ code ([ movl shape (Reg EDX) ]
+                         ++ checkRecord i slow
+                         ++ [ movl (recordField i) (Reg valReg)
+                            , Label done
+                            , Directive ".subsection 1"
+                            , Label slow ]
+                         ++ push EDX
+                         ++ push valReg
+                         ++ [ movl (Imm index) (Reg ECX) ]
+                         ++ push ECX
+                         ++ [ movl (globalRef cell) (Reg procReg)
+                            , movl (Imm 3) (Reg ECX) ])
+                ++ [ Safepoint [Call (Abs "flnv_apply" 0)] ]
+                ++ code [ Jmp (Abs done 0)
+                        , Directive ".subsection 0" ]
+compile _ (Apply (GlobalRef "record-set!") [t, r, ANumber i, x]) | fastField i =
+    do tCode  <- compile NonTail t
+       rCode  <- compile NonTail r
+       xCode  <- compile NonTail x
+       shape  <- newTemp
+       record <- newTemp
+       field  <- newTemp
+       cell   <- global "record-set!"
+       index  <- fixnum i
+       slow   <- newLabel "slow"
+       done   <- newLabel "done"
+       return $ tCode
+                ++ code [ movl (Reg valReg) shape ]
+                ++ rCode
+                ++ code [ movl (Reg valReg) record ]
+                ++ xCode
+                ++ code ([ movl (Reg valReg) field
+                         , movl record (Reg valReg)
+                         , movl shape (Reg EDX) ]
+                         ++ checkRecord i slow
+                         ++ [ movl field (Reg EDX)
+                            , movl (Reg EDX) (recordField i)
+                            , movl (Reg EDX) (Reg valReg)
+                            , Label done
+                            , Directive ".subsection 1"
+                            , Label slow ]
+                         ++ push EDX
+                         ++ push valReg
+                         ++ [ movl (Imm index) (Reg ECX) ]
+                         ++ push ECX
+                         ++ [ movl field (Reg ECX) ]
+                         ++ push ECX
+                         ++ [ movl (globalRef cell) (Reg procReg)
+                            , movl (Imm 4) (Reg ECX) ])
+                ++ [ Safepoint [Call (Abs "flnv_apply" 0)] ]
+                ++ code [ Jmp (Abs done 0)
+                        , Directive ".subsection 0" ]
+compile p (Apply f args) =
+    do argCode <- mapM (compile NonTail) args
+       fCode   <- compile NonTail f
+       mark    <- gets regionMark
+       return $ concatMap (++ code (push valReg)) argCode
+                ++ fCode
+                ++ code [ movl (Reg valReg) (Reg procReg) ]
+                ++ call p mark
+    where m = genericLength args
+          call NonTail _     = [ Instr $ movl (Imm m) (Reg ECX)
+                               , Safepoint [Call (Abs "flnv_apply" 0)] ]
+          call (Tail n) mark = code $ maybe [] releaseRegion mark
+                                 ++ [ movl (Mem (n * handleBytes) frameReg) (Reg envReg) ]
+                                 ++ concatMap moveArg [0 .. m - 1]
+                                 ++ [ Lea (Mem (m * handleBytes) frameReg) (Reg stackReg)
+                                    , Pop (Reg frameReg)
+                                    , movl (Imm m) (Reg ECX)
+                                    , Jmp (Abs "flnv_apply" 0) ]
+          moveArg i = [ movl (Mem ((i - m) * handleBytes) stackReg) (Reg EDX)
+                      , movl (Reg EDX) (Mem (i * handleBytes) frameReg) ]
+
+-- Build a closure or pair, given how to allocate it
+build :: (Integer -> Compile [IR]) -> AST -> Compile [IR]
+build alloc (Closure arity captured body) =
+    do start    <- newLabel "lambda"
+       mark     <- if allocatesInFrame body then liftM Just newTemp else return Nothing
+       bodyCode <- inProcedure mark $ compile (Tail n) body
+       let (bodyCode', slots) = allocateRegisters (frameSlot $ n + 1) $
+                                maybe [] (code . markRegion) mark
+                                ++ bodyCode
+                                ++ maybe [] (code . releaseRegion) mark
+       emitProcedure $ [ Label start
+                       , Cmp LONG (Imm n) (Reg ECX)
+                       , J NOT_EQUAL "flnv_arity_error"
+                       , Push (Reg frameReg)
+                       , Lea (Mem (-n * handleBytes) stackReg) (Reg frameReg) ]
+                       ++ push envReg
+                       ++ reserveSlots slots
+                       ++ [ movl (Reg procReg) (Reg envReg) ]
+                       ++ bodyCode'
+                       ++ [ movl (Mem (n * handleBytes) frameReg) (Reg envReg)
+                          , movq (Reg frameReg) (Reg stackReg)
+                          , Pop (Reg frameReg)
+                          , Ret ]
+       closure  <- alloc $ closureWords nfree
+       captures <- zipWithM capture [0..] captured
+       return $ closure
+                ++ code ([ movq (Addr "sc_closure_ops") (Mem 0 RAX)
+                         , movq (Addr start) (Mem closureCode RAX)
+                         , movl (Imm nfree) (Mem closureSize RAX) ]
+                         ++ concat captures
+                         ++ [ Or LONG (Imm pointerTag) (Reg valReg) ])
+    where n     = toInteger arity
+          nfree = genericLength captured
+          capture i ref = do load <- fetch ref EDX
+                             return $ load ++ [ movl (Reg EDX) (Mem (closureFree + i * handleBytes) RAX) ]
+build alloc (Apply (GlobalRef "cons") [a, b]) =
+    do aCode <- compile NonTail a
+       bCode <- compile NonTail b
+       car   <- newTemp
+       cdr   <- newTemp
+       pair  <- alloc consWords
+       return $ aCode
+                ++ code [ movl (Reg valReg) car ]
+                ++ bCode
+                ++ code [ movl (Reg valReg) cdr ]
+                ++ pair
+                ++ code [ movq (Addr "sc_cons_ops") (Mem 0 RAX)
+                        , movl car (Reg EDX)
+                        , movl (Reg EDX) (Mem consCar RAX)
+                        , movl cdr (Reg EDX)
+                        , movl (Reg EDX) (Mem consCdr RAX)
+                        , Or LONG (Imm pointerTag) (Reg valReg) ]
+build _ ast = throwError $ InternalError $ "Can't allocate " ++ show ast
+
+-- Globals are never assigned, so a call through one of these names is
+-- always a call to the primitive, and for two fixnum operands we can
+-- do it inline. Fixnums are 4n+1 and no handle is tagged 3, so both
+-- operands are fixnums exactly when bit 0 of their AND is set.
+--
+-- Tagging preserves order, so comparisons work on the handles
+-- directly. For arithmetic we adjust one operand by the tag first, so
+-- that the add or subtract itself produces a tagged result and sets
+-- the overflow flag exactly when that result is out of fixnum range.
+data Inline = Arithmetic Instruction (Operand -> Operand -> Instruction)
+            | Comparison Condition
+
+inlinePrimitives :: [(String, Inline)]
+inlinePrimitives = [ ("+", Arithmetic (Sub LONG (Imm 1) (Reg ECX)) (Add LONG))
+                   , ("-", Arithmetic (Add LONG (Imm 1) (Reg ECX)) (Sub LONG))
+                   , ("<", Comparison LESS)
+                   , (">", Comparison GREATER)
+                   , ("=", Comparison EQUAL) ]
+
+-- With the first operand in %edx and the second in val
+inline :: Inline -> String -> String -> [Instruction]
+inline (Arithmetic adjust op) slow _ = [ movl (Reg EDX) (Reg ECX)
+                                       , adjust
+                                       , op (Reg valReg) (Reg ECX)
+                                       , J OVERFLOW slow
+                                       , movl (Reg ECX) (Reg valReg) ]
+inline (Comparison c) _ done = [ Cmp LONG (Reg valReg) (Reg EDX)
+                               , movl (Abs "sc_true" 0) (Reg valReg)
+                               , J c done
+                               , movl (Abs "sc_false" 0) (Reg valReg) ]
+
+-- With the record type in %edx and the record in val, check that val
+-- is a record of that type whose field i holds a handle: a record's
+-- header points into its shape, so comparing it with the type's
+-- address tells us the type, and then the shape's pointer bitmap tells
+-- us the field exists and what it holds. Raw fields, and anything
+-- else, go to slow.
+checkRecord :: Integer -> String -> [Instruction]
+checkRecord i slow = [ movl (Reg valReg) (Reg ECX)
+                     , And LONG (Imm tagMask) (Reg ECX)
+                     , Cmp LONG (Imm pointerTag) (Reg ECX)
+                     , J NOT_EQUAL slow
+                     , Cmp LONG (Imm nilHandle) (Reg valReg)
+                     , J EQUAL slow
+                     , Lea (Mem (shapeOps - pointerTag) RDX) (Reg RCX)
+                     , Cmp QUADWORD (Reg RCX) (Mem (-pointerTag) RAX)
+                     , J NOT_EQUAL slow
+                     , Test LONG (Imm $ 2 ^ i) (Mem (shapeBitmap - pointerTag) RDX)
+                     , J EQUAL slow ]
+
+-- Field i of the record in val
+recordField :: Integer -> Operand
+recordField i = Mem (recordFields - pointerTag + i * handleBytes) RAX
+
+-- Load an argument, captured variable or Let binding of the current
+-- procedure
+fetch :: AST -> Register -> Compile [Instruction]
+fetch (LocalRef i) r = return [ movl (Mem (toInteger i * handleBytes) frameReg) (Reg r) ]
+fetch (FreeRef i)  r = return [ movl (Mem (closureFree - pointerTag + toInteger i * handleBytes)
+                                          (resizeRegister QUADWORD envReg)) (Reg r) ]
+fetch (BoundRef v) r = do bs <- gets bindings
+                          case lookup v bs of
+                            Just t  -> return [ movl t (Reg r) ]
+                            Nothing -> throwError $ InternalError $ "Unbound Let variable " ++ v
+fetch ast          _ = throwError $ InternalError $ "fetch: not a local variable: " ++ show ast
+
+{- Program layout -}
+
+compileProgram :: AST -> Either Error [Instruction]
+compileProgram ast = runCompile $ do body   <- compile NonTail $ stackAllocate $
+                                                   closureConvert $ optimize ast
+                                     procs  <- gets procedures
+                                     consts <- gets constants
+                                     gs     <- gets globals
+                                     return $ uncurry entry (allocateRegisters (frameSlot 0) body)
+                                            ++ procs
+                                            ++ runtimeGlue
+                                            ++ dataSection consts gs
+
+-- The top level runs in a frame with no arguments and no saved env
+entry :: [Instruction] -> Integer -> [Instruction]
+entry body slots = [ Directive ".text"
+                   , Directive ".globl flnv_entry"
+                   , Label "flnv_entry" ]
+                   ++ map (Push . Reg) calleeSaved
+                   ++ [ movq (Abs "rt_sp" 0) (Reg stackReg)
+                      , movq (Reg stackReg) (Reg frameReg)
+                      , movl (Abs "rt_env" 0) (Reg envReg)
+                      , movl (Imm nilHandle) (Reg procReg) ]
+                   ++ reserveSlots slots
+                   ++ body
+                   ++ [ movq (Reg frameReg) (Reg stackReg)
+                      , movq (Reg stackReg) (Abs "rt_sp" 0) ]
+                   ++ map (Pop . Reg) (reverse calleeSaved)
+                   ++ [ Ret ]
+    where calleeSaved = [RBX, RBP, R12, R13, R14, R15]
+
+-- flnv_apply type-checks proc and jumps to its code. Primitives all
+-- share flnv_apply_primitive as their code, which calls into C.
+runtimeGlue :: [Instruction]
+runtimeGlue = [ Label "flnv_apply"
+              , movl (Reg procReg) (Reg EDX)
+              , And LONG (Imm tagMask) (Reg EDX)
+              , Cmp LONG (Imm pointerTag) (Reg EDX)
+              , J NOT_EQUAL "flnv_not_procedure"
+              , Cmp LONG (Imm nilHandle) (Reg procReg)
+              , J EQUAL "flnv_not_procedure"
+              , movq (Mem (-pointerTag) RBX) (Reg RDX)
+              , Cmp QUADWORD (Addr "sc_closure_ops") (Reg RDX)
+              , J EQUAL "flnv_apply_code"
+              , Cmp QUADWORD (Addr "sc_primitive_ops") (Reg RDX)
+              , J NOT_EQUAL "flnv_not_procedure"
+              , Label "flnv_apply_code"
+              , Jmp (Mem (closureCode - pointerTag) RBX)
+              , Label "flnv_not_procedure"
+              , movl (Reg procReg) (Reg EDI) ]
+              ++ callRuntime "rt_error_not_procedure"
+              ++ [ Label "flnv_arity_error"
+                 , movl (Reg ECX) (Reg EDI) ]
+              ++ callRuntime "rt_error_arity"
+              ++ [ Directive ".globl flnv_apply_primitive"
+                 , Label "flnv_apply_primitive"
+                 , movl (Reg ECX) (Reg EDI) ]
+              ++ callRuntime "rt_apply_primitive"
+              ++ [ Ret ]
+
+-- The constant and global cells are scanned by the collector; their
+-- descriptors and names are read by the runtime at startup.
+dataSection :: [Constant] -> [String] -> [Instruction]
+dataSection cs gs = [ Directive ".data"
+                    , Directive ".globl flnv_constants"
+                    , Directive ".align 8"
+                    , Label "flnv_constants"
+                    , Directive $ ".fill " ++ show (length cs) ++ ", 4, 0"
+                    , Directive ".globl flnv_globals"
+                    , Label "flnv_globals"
+                    , Directive $ ".fill " ++ show (length gs) ++ ", 4, 0"
+                    , Directive ".section .rodata"
+                    , Directive ".globl flnv_nconstants"
+                    , Directive ".globl flnv_nglobals"
+                    , Directive ".align 4"
+                    , Label "flnv_nconstants"
+                    , Directive $ ".long " ++ show (length cs)
+                    , Label "flnv_nglobals"
+                    , Directive $ ".long " ++ show (length gs)
+                    , Directive ".globl flnv_constant_table"
+                    , Label "flnv_constant_table" ]
+                    ++ concat (zipWith descriptor [0..] cs)
+                    ++ [ Directive ".globl flnv_global_names"
+                       , Directive ".align 8"
+                       , Label "flnv_global_names" ]
+                    ++ map (Directive . (".quad " ++) . globalName) [0 .. length gs - 1]
+                    ++ concat (zipWith (staticObject cs) [0..] cs)
+                    ++ concat (zipWith globalString [0..] gs)
+                    ++ [ Directive ".section .note.GNU-stack,\"\",@progbits" ]
+    where descriptor :: Int -> Constant -> [Instruction]
+          descriptor i c = case (c, constantHandle cs i) of
+                             (CSymbol _, Just h)  -> rtConstant 2 h "0"
+                             (_, Just h)          -> rtConstant 0 h "0"
+                             (CBool b, _)         -> rtConstant 1 (if b then "1" else "0") "0"
+                             (CCons a d, Nothing) -> rtConstant 3 (show a) (show d)
+                             _                    -> error "dataSection: no descriptor"
+          globalString i g = [ Label $ globalName i, Directive $ ".asciz " ++ asmString g ]
+          globalName i = ".Lglobal" ++ show i
+
+rtConstant :: Integer -> String -> String -> [Instruction]
+rtConstant kind car cdr = [ Directive $ ".long " ++ intercalate ", " [show kind, car, cdr] ]
+
+-- The handle of a constant, as an assembler expression, if it is
+-- known at link time: that of an immediate, or of a static object.
+constantHandle :: [Constant] -> Int -> Maybe String
+constantHandle cs i = case cs !! i of
+                        CImmediate h          -> Just $ show h
+                        c | isStatic cs c     -> Just $ staticLabel i ++ "+" ++ show pointerTag
+                          | otherwise         -> Nothing
+
+-- Static objects live in .rodata, in the format scgc.c gives them, and
+-- are never copied or scanned by the collector (see gc.h). So they can
+-- only refer to immediates and to each other. Booleans are allocated
+-- by the runtime, so they and pairs containing them are built at
+-- startup instead. Static symbols are added to the obarray at startup.
+isStatic :: [Constant] -> Constant -> Bool
+isStatic _  (CSymbol _) = True
+isStatic _  (CString _) = True
+isStatic cs (CCons a d) = all (isJust . constantHandle cs) [a, d]
+isStatic _  _           = False
+
+staticObject :: [Constant] -> Int -> Constant -> [Instruction]
+staticObject _ i (CSymbol s) = staticString "sc_symbol_ops" i s
+staticObject _ i (CString s) = staticString "sc_string_ops" i s
+staticObject cs i c@(CCons a d)
+    | isStatic cs c = [ Directive ".align 8"
+                      , Label $ staticLabel i
+                      , Directive ".quad sc_cons_ops"
+                      , Directive $ ".long " ++ intercalate ", " (mapMaybe (constantHandle cs) [a, d]) ]
+staticObject _ _ _ = []
+
+-- sc_string: header, length including the terminator, characters
+staticString :: String -> Int -> String -> [Instruction]
+staticString ops i s = [ Directive ".align 8"
+                       , Label $ staticLabel i
+                       , Directive $ ".quad " ++ ops
+                       , Directive $ ".long " ++ show (length s + 1)
+                       , Directive $ ".asciz " ++ asmString s ]
+
+staticLabel :: Int -> String
+staticLabel i = ".Lstatic" ++ show i
+
+asmString :: String -> String
+asmString s = '"' : concatMap escape s ++ "\""
+    where escape c | c == '"' || c == '\\'   = ['\\', c]
+                   | isAscii c && isPrint c = [c]
+                   | otherwise              = '\\' : octal (ord c `mod` 256)
+          octal n = map intToDigit [n `div` 64, n `div` 8 `mod` 8, n `mod` 8]
@@ -13,6 +13,7 @@ data Error = Error String
            | InternalError String
            | Undefined String
            | DuplicateBinding String
+           | CompileError String
              deriving Show
 
 instance E.Error Error where
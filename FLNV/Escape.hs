@@ -0,0 +1,74 @@
+module FLNV.Escape (stackAllocate, allocatesInFrame) where
+
+import FLNV.AST
+
+-- Escape analysis, on closure-converted code. A closure or pair bound
+-- by a Let can be allocated in the current procedure's frame (see
+-- StackAlloc) if every use of the variable in the Let's body is one
+-- through which the object can't outlive the call:
+--
+--  * as the argument of car, cdr, null?, pair?, not or eq?, or the
+--    operator of a call, as long as the call is not a tail call, which
+--    would release the frame before the callee runs;
+--  * as the predicate of an If, or in a Sequence that discards it.
+--
+-- Anything else -- returning it, passing it to a procedure, storing it
+-- in a pair or a closure, or binding it to another name -- counts as
+-- escaping. So nothing outside a frame ever points into it.
+stackAllocate :: AST -> AST
+stackAllocate = annotate False
+
+-- Given whether the expression is in tail position
+annotate :: Bool -> AST -> AST
+annotate _ (Closure n captured body) = Closure n captured $ annotate True body
+annotate t (Let binds body)  = Let [ (v, allocate v $ annotate False e) | (v, e) <- binds ] body'
+    where body' = annotate t body
+          allocate v e | allocates e && not (escapes v t body') = StackAlloc e
+                       | otherwise                              = e
+annotate t (If p c a)        = If (annotate False p) (annotate t c) (annotate t a)
+annotate _ (Sequence [])     = Sequence []
+annotate t (Sequence asts)   = Sequence $ map (annotate False) (init asts) ++ [annotate t $ last asts]
+annotate _ (Apply f args)    = Apply (annotate False f) (map (annotate False) args)
+annotate _ ast               = ast
+
+allocates :: AST -> Bool
+allocates (Closure _ _ _)                    = True
+allocates (Apply (GlobalRef "cons") [_, _]) = True
+allocates _                                  = False
+
+-- Whether the object bound to v may outlive the frame through an
+-- expression whose value is used, given whether it's in tail position
+escapes :: String -> Bool -> AST -> Bool
+escapes v _ (BoundRef w)          = v == w
+escapes v t (If p c a)            = tested v p || escapes v t c || escapes v t a
+escapes v t (Sequence asts@(_:_)) = any (tested v) (init asts) || escapes v t (last asts)
+escapes v t (Let binds body)      = any (escapes v False . snd) binds
+                                    || (v `notElem` map fst binds && escapes v t body)
+escapes v _ (Closure _ captured _) = any (escapes v False) captured
+escapes v t (StackAlloc e)        = escapes v t e
+escapes v False (Apply f args)
+    | safe f                      = any (operand v) args
+    | BoundRef w <- f, v == w     = any (escapes v False) args
+    where safe (GlobalRef g) = g `elem` ["car", "cdr", "null?", "pair?", "not", "eq?"]
+          safe _             = False
+escapes v _ (Apply f args)        = any (escapes v False) (f:args)
+escapes _ _ _                     = False
+
+-- An expression whose value is ignored, or only tested for truth
+tested :: String -> AST -> Bool
+tested _ (BoundRef _) = False
+tested v ast          = escapes v False ast
+
+-- An argument to a primitive that only looks at it
+operand :: String -> AST -> Bool
+operand v (BoundRef w) | v == w = False
+operand v ast                   = escapes v False ast
+
+-- Whether a procedure body allocates anything in its frame
+allocatesInFrame :: AST -> Bool
+allocatesInFrame (StackAlloc _)   = True
+allocatesInFrame (Let binds body) = any (allocatesInFrame . snd) binds || allocatesInFrame body
+allocatesInFrame (If p c a)       = any allocatesInFrame [p, c, a]
+allocatesInFrame (Sequence asts)  = any allocatesInFrame asts
+allocatesInFrame (Apply f args)   = any allocatesInFrame (f:args)
+allocatesInFrame _                = False
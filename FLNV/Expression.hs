@@ -8,19 +8,19 @@ data Expression = Symbol String
                 | Nil
                   deriving (Eq)
 
+-- Built with ShowS so that printing is linear in the size of the output
 instance Show Expression where
-    show (Symbol s) = s
-    show (Number n) = show n
-    show (String s) = '"' : s ++ "\""
-    show (Bool True) = "#t"
-    show (Bool False) = "#f"
-    show c@(Cons a b) = "(" ++ showListInner c ++ ")"
-    show Nil = "()"
-
-showListInner :: Expression -> String
-showListInner (Cons a b@(Cons _ _)) = show a ++ " " ++ showListInner b
-showListInner (Cons a Nil) = show a
-showListInner (Cons a b) = show a ++ " . " ++ showListInner b
-showListInner Nil = ""
-showListInner x = show x
+    showsPrec _ (Symbol s) = showString s
+    showsPrec _ (Number n) = shows n
+    showsPrec _ (String s) = showChar '"' . showString s . showChar '"'
+    showsPrec _ (Bool True) = showString "#t"
+    showsPrec _ (Bool False) = showString "#f"
+    showsPrec _ c@(Cons _ _) = showChar '(' . showListInner c . showChar ')'
+    showsPrec _ Nil = showString "()"
 
+showListInner :: Expression -> ShowS
+showListInner (Cons a b@(Cons _ _)) = shows a . showChar ' ' . showListInner b
+showListInner (Cons a Nil) = shows a
+showListInner (Cons a b) = shows a . showString " . " . showListInner b
+showListInner Nil = id
+showListInner x = shows x
@@ -0,0 +1,22 @@
+module FLNV.IR (IR(..), code, temps) where
+
+import FLNV.Asm
+
+-- The compiler's output for a procedure body, before register
+-- allocation (see FLNV.Allocate). Instructions may use temporaries
+-- (Temp operands) as well as the fixed machine registers, but each
+-- mentions at most one temporary, so that any of them can be replaced
+-- by a memory operand.
+--
+-- A Safepoint is a call out of compiled code, either to a procedure
+-- or into the runtime. It may run the collector, and clobbers every
+-- register the allocator hands out.
+data IR = Instr Instruction
+        | Safepoint [Instruction]
+
+code :: [Instruction] -> [IR]
+code = map Instr
+
+temps :: IR -> [Int]
+temps (Instr i)     = [ t | Temp t <- operands i ]
+temps (Safepoint _) = []
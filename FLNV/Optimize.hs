@@ -0,0 +1,105 @@
+module FLNV.Optimize (optimize) where
+
+import FLNV.AST
+import FLNV.Expression
+import Control.Monad
+import Data.List
+
+-- Simplifications on the desugared AST, before closure conversion:
+--
+--  * A Lambda applied directly to as many arguments as it takes, as
+--    every let is, becomes a Let, which needs no closure or call.
+--    Bindings of literals are substituted into the body instead.
+--  * Calls to arithmetic and comparison primitives with literal
+--    arguments are folded, as long as the result is a fixnum.
+--  * An If whose predicate is a literal becomes the arm it would take,
+--    and literals whose values are unused are dropped from sequences.
+--
+-- Globals are never assigned, so a name that isn't bound locally is
+-- always the primitive of that name, if there is one.
+optimize :: AST -> AST
+optimize = simplify []
+
+simplify :: [String] -> AST -> AST
+simplify bound (Lambda args body) = Lambda args $ simplify (args ++ bound) body
+simplify bound (Apply (Lambda args body) vals)
+    | length args == length vals = bind bound (zip args $ map (simplify bound) vals) body
+simplify bound (Apply f args)     = case (simplify bound f, map (simplify bound) args) of
+                                      (AVar v, args') | v `notElem` bound,
+                                                        Just ast <- fold v args' -> ast
+                                      (f', args') -> Apply f' args'
+simplify bound (Let binds body)   = bind bound [ (v, simplify bound e) | (v, e) <- binds ] body
+simplify bound (If p c a)         = case simplify bound p of
+                                      p' | Just b <- truth p' -> simplify bound $ if b then c else a
+                                         | otherwise          -> If p' (simplify bound c)
+                                                                       (simplify bound a)
+simplify bound (Sequence asts)    = case map (simplify bound) asts of
+                                      []    -> Sequence []
+                                      asts' -> sequence' $ filter (not . constant) (init asts')
+                                                           ++ [last asts']
+    where sequence' [ast] = ast
+          sequence' asts' = Sequence asts'
+          constant = maybe False (const True) . truth
+simplify _ ast                    = ast
+
+-- Bind already-simplified values around a body
+bind :: [String] -> [(String, AST)] -> AST -> AST
+bind bound binds body = wrap $ simplify (map fst kept ++ bound) $
+                        foldr (uncurry substitute) body literals
+    where (literals, kept) = partition (literal . snd) binds
+          wrap body' | null kept = body'
+                     | otherwise = Let kept body'
+          literal (ANumber _) = True
+          literal (ABool _)   = True
+          literal _           = False
+
+substitute :: String -> AST -> AST -> AST
+substitute v e (AVar w) | v == w = e
+substitute v e l@(Lambda args body)
+    | v `elem` args = l
+    | otherwise     = Lambda args $ substitute v e body
+substitute v e (Let binds body) = Let [ (w, substitute v e x) | (w, x) <- binds ] body'
+    where body' | v `elem` map fst binds = body
+                | otherwise              = substitute v e body
+substitute v e (If p c a)      = If (substitute v e p) (substitute v e c) (substitute v e a)
+substitute v e (Apply f args)  = Apply (substitute v e f) $ map (substitute v e) args
+substitute v e (Sequence asts) = Sequence $ map (substitute v e) asts
+substitute _ _ ast             = ast
+
+-- Whether a value is known to be true or false at compile time. Only
+-- #f is false.
+truth :: AST -> Maybe Bool
+truth (ABool b)           = Just b
+truth (Quoted (Bool b))   = Just b
+truth (ANumber _)         = Just True
+truth (AString _)         = Just True
+truth (Quoted _)          = Just True
+truth (Lambda _ _)        = Just True
+truth _                   = Nothing
+
+-- The primitives as runtime.c defines them, on fixnums
+fold :: String -> [AST] -> Maybe AST
+fold "+" args     = mapM number args >>= fixnum . sum
+fold "*" args     = mapM number args >>= fixnum . product
+fold "-" [a]      = number a >>= fixnum . negate
+fold "-" (a:args) = do n  <- number a
+                       ns <- mapM number args
+                       fixnum $ n - sum ns
+fold "=" [a, b]   = compare' (==) a b
+fold "<" [a, b]   = compare' (<) a b
+fold ">" [a, b]   = compare' (>) a b
+fold "not" [a]    = liftM (ABool . not) $ truth a
+fold _ _          = Nothing
+
+number :: AST -> Maybe Integer
+number (ANumber n) = Just n
+number _           = Nothing
+
+fixnum :: Integer -> Maybe AST
+fixnum n | isFixnum n = Just $ ANumber n
+         | otherwise  = Nothing
+
+compare' :: (Integer -> Integer -> Bool) -> AST -> AST -> Maybe AST
+compare' op a b = do x <- number a
+                     y <- number b
+                     return $ ABool $ op x y
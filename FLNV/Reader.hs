@@ -0,0 +1,134 @@
+module FLNV.Reader (readForms, readProgram) where
+
+import FLNV.Expression
+import FLNV.Error
+import Data.Char
+import Data.List
+import qualified Data.ByteString.Lazy.Char8 as L
+import Text.ParserCombinators.Parsec.Pos (SourcePos, newPos)
+import Text.ParserCombinators.Parsec.Error (Message(..), newErrorMessage)
+
+-- A reader for source files of any size, over lazy ByteStrings, with
+-- a hand-written lexer. It accepts the language FLNV.Parser does, plus
+-- ; comments and any number of top-level forms, which it returns as it
+-- reads them. Only the form being read, and the chunks of input it
+-- spans, need to be in memory at once.
+
+-- The unread input, and its line and column
+data Input = Input !Int !Int L.ByteString
+
+-- Errors carry the input at the point they were found
+type Parse a = Input -> Either (Input, String) (a, Input)
+
+-- Each top-level form with the position it starts at. A syntax error
+-- ends the list.
+readForms :: FilePath -> L.ByteString -> [Either Error (SourcePos, Expression)]
+readForms name = forms . Input 1 1
+    where forms input = case skipSpace input of
+                          Input _ _ s | L.null s -> []
+                          start -> case form start of
+                                     Left (at, msg)  -> [Left $ readError name at msg]
+                                     Right (e, rest) -> let at = position name start
+                                                        in at `seq` Right (at, e) : forms rest
+
+-- A whole program: its top-level forms in sequence, as if in a begin
+readProgram :: (MonadError Error m) => FilePath -> L.ByteString -> m Expression
+readProgram name s = do exprs <- mapM (either throwError (return . snd)) $ readForms name s
+                        return $ case exprs of
+                                   [e] -> e
+                                   _   -> Cons (Symbol "begin") $ foldr Cons Nil exprs
+
+position :: FilePath -> Input -> SourcePos
+position name (Input line col _) = newPos name line col
+
+readError :: FilePath -> Input -> String -> Error
+readError name at msg = ReadErr $ newErrorMessage (Message msg) (position name at)
+
+{- The lexer -}
+
+skipSpace :: Input -> Input
+skipSpace input@(Input line col s) =
+    case L.uncons s of
+      Just ('\n', s')          -> skipSpace $ Input (line + 1) 1 s'
+      Just (c, s') | isSpace c -> skipSpace $ Input line (col + 1) s'
+                   | c == ';'  -> skipSpace $ uncurry (past input) $ L.break (== '\n') s
+      _                        -> input
+
+-- The input after a prefix of it that has been read
+past :: Input -> L.ByteString -> L.ByteString -> Input
+past (Input line col _) prefix rest
+    | newlines == 0 = Input line (col + len prefix) rest
+    | otherwise     = Input (line + newlines) (1 + len lastLine) rest
+    where newlines = fromIntegral $ L.count '\n' prefix
+          lastLine = L.takeWhile (/= '\n') $ L.reverse prefix
+          len      = fromIntegral . L.length
+
+-- The input after its next character, which isn't a newline
+next :: Input -> Input
+next (Input line col s) = Input line (col + 1) (L.tail s)
+
+-- Copy a token out of the input, so that the Expression doesn't keep
+-- the chunk it came from alive. Callers force the result to WHNF.
+unpack :: L.ByteString -> String
+unpack t = let s = L.unpack t in length s `seq` s
+
+delimiter :: Char -> Bool
+delimiter c = isSpace c || c `elem` "()'\";"
+
+symbolStart, symbolChar :: Char -> Bool
+symbolStart c = isAlpha c || c `elem` "*!$?<>=/+:_{}#-"
+symbolChar c  = symbolStart c || isDigit c || c == '.'
+
+{- The parser -}
+
+form :: Parse Expression
+form input@(Input _ _ s) =
+    case L.uncons s of
+      Nothing        -> Left (input, "unexpected end of input")
+      Just ('(', _)  -> list [] $ skipSpace $ next input
+      Just (')', _)  -> Left (input, "unexpected )")
+      Just ('\'', _) -> case form $ skipSpace $ next input of
+                          Right (e, rest) -> Right (Cons (Symbol "quote") (Cons e Nil), rest)
+                          err             -> err
+      Just ('"', _)  -> string $ next input
+      Just _         -> atom input
+
+-- The rest of a list, after the ( or an element and any space, given
+-- the elements so far in reverse. Iterative, so that long lists don't
+-- need a deep stack.
+list :: [Expression] -> Parse Expression
+list elems input@(Input _ _ s) =
+    case L.uncons s of
+      Just (')', _)                    -> Right (foldl' (flip Cons) Nil elems, next input)
+      Just ('.', s') | dot s', _:_ <- elems
+                                       -> case form $ skipSpace $ next input of
+                                            Right (e, rest) -> close (foldl' (flip Cons) e elems) $ skipSpace rest
+                                            err             -> err
+      _                                -> case form input of
+                                            Right (e, rest) -> list (e : elems) $ skipSpace rest
+                                            Left err        -> Left err
+    where dot s' = maybe True (delimiter . fst) $ L.uncons s'
+          close e rest@(Input _ _ s') = case L.uncons s' of
+                                          Just (')', _) -> Right (e, next rest)
+                                          _             -> Left (rest, "expected ) after dotted tail")
+
+-- After the opening quote. There are no escapes.
+string :: Parse Expression
+string input@(Input _ _ s) =
+    case L.break (== '"') s of
+      (str, rest) | L.null rest -> Left (input, "unterminated string literal")
+                  | otherwise   -> let str' = unpack str
+                                   in str' `seq` Right (String str', next $ past input str rest)
+
+atom :: Parse Expression
+atom input@(Input line col s)
+    | L.all isDigit token, Just (n, _) <- L.readInteger token
+                  = n `seq` Right (Number n, rest')
+    | not (L.null token) && symbolStart (L.head token) && L.all symbolChar token
+                  = let e = symbol $ unpack token in e `seq` Right (e, rest')
+    | otherwise   = Left (input, "unexpected " ++ show (L.unpack token))
+    where (token, rest) = L.span (not . delimiter) s
+          rest'         = Input line (col + fromIntegral (L.length token)) rest
+          symbol "#t"   = Bool True
+          symbol "#f"   = Bool False
+          symbol sym    = Symbol sym
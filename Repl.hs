@@ -1,15 +1,18 @@
 import FLNV.Expression
-import FLNV.Parser
+import FLNV.Reader
 import FLNV.AST
 import FLNV.Error
 import System.IO
 import System.Exit
+import qualified Data.ByteString.Lazy.Char8 as L
+import Text.ParserCombinators.Parsec.Pos (SourcePos)
 
-runParser :: String -> IO Expression
-runParser str = case (readExpr str :: Either Error Expression) of
-                  Right expr -> return expr
-                  Left err -> do putStrLn (show err)
-                                 exitWith $ ExitFailure 1
+-- Forms are desugared and shown as they are read
+showForm :: Either Error (SourcePos, Expression) -> IO ()
+showForm (Left err)        = do putStrLn (show err)
+                                exitWith $ ExitFailure 1
+showForm (Right (_, expr)) = do ast <- doDesugar expr
+                                putStrLn $ show ast
 
 doDesugar :: Expression -> IO AST
 doDesugar exp = do case (runDesugar $ desugar exp) of
@@ -18,8 +21,6 @@ doDesugar exp = do case (runDesugar $ desugar exp) of
                      (Right ast) -> return ast
 
 main :: IO ()
-main = do prog <- getContents
-          expr <- runParser prog
-          ast  <- doDesugar expr
-          putStrLn $ show ast
+main = do prog <- L.getContents
+          mapM_ showForm $ readForms "stdin" prog
           exitWith ExitSuccess
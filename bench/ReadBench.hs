@@ -0,0 +1,67 @@
+-- Reader throughput. Given a file, reads it with FLNV.Reader; given a
+-- size in megabytes (default 8), generates that much source and reads
+-- it with both FLNV.Reader and the Parsec reader in FLNV.Parser. Run
+-- with +RTS -s to see maximum residency: the streaming reader's should
+-- stay flat however large the input.
+import FLNV.Expression
+import FLNV.Parser
+import FLNV.Reader
+import FLNV.Error
+import Data.Char
+import Data.List
+import System.Environment
+import System.IO
+import System.CPUTime
+import Text.Printf
+import Text.ParserCombinators.Parsec.Pos (SourcePos)
+import qualified Data.ByteString.Lazy.Char8 as L
+
+sample :: L.ByteString
+sample = L.pack $ unlines
+         [ "(let ((loop (lambda (loop n acc)"
+         , "              (if (= n 0)"
+         , "                  acc"
+         , "                  (loop loop (- n 1) (cons \"item\" '(a b . 3)))))))"
+         , "  (loop loop 1000000 '()))" ]
+
+generate :: Int -> L.ByteString
+generate mb = L.concat $ replicate copies sample
+    where copies = mb * 1024 * 1024 `div` fromIntegral (L.length sample)
+
+-- Force each expression, counting its nodes
+size :: Expression -> Int
+size (Cons a b) = 1 + size a + size b
+size _          = 1
+
+nodes :: [Either Error (SourcePos, Expression)] -> Int
+nodes = foldl' count 0
+    where count n (Right (_, e)) = n + size e
+          count _ (Left err)     = error $ show err
+
+timed :: String -> Double -> IO Int -> IO ()
+timed name mb action = do start <- getCPUTime
+                          n     <- action
+                          end   <- n `seq` getCPUTime
+                          let secs = fromIntegral (end - start) / 1e12 :: Double
+                          printf "%s: %d nodes, %.2fs, %.1f MB/s\n" name n secs (mb / secs)
+
+readFile' :: FilePath -> IO ()
+readFile' path = do bytes <- withFile path ReadMode hFileSize
+                    input <- L.readFile path
+                    timed "FLNV.Reader" (fromIntegral bytes / 2^20) $
+                          return $ nodes $ readForms path input
+
+generated :: Int -> IO ()
+generated mb = do timed "FLNV.Reader" (fromIntegral mb) $
+                        return $ nodes $ readForms "generated" $ generate mb
+                  timed "FLNV.Parser" (fromIntegral mb) $
+                        case readExpr $ "(" ++ L.unpack (generate mb) ++ ")" of
+                          Left err -> error $ show (err :: Error)
+                          Right e  -> return $ size e
+
+main :: IO ()
+main = do args <- getArgs
+          case args of
+            [arg] | all isDigit arg -> generated $ read arg
+                  | otherwise       -> readFile' arg
+            _                       -> generated 8
@@ -0,0 +1,9 @@
+; Two closures made and called on every iteration, reading their
+; captured variables: closure allocation and free variable references.
+(let ((loop (lambda (loop n acc)
+              (if (= n 0)
+                  acc
+                  (let ((inc (lambda (x) (+ x acc)))
+                        (dec (lambda (x) (- x n))))
+                    (loop loop (- n 1) (inc (dec (+ n 1)))))))))
+  (loop loop 1000000 0))
@@ -0,0 +1,6 @@
+; Doubly-recursive fib: mostly calls and fixnum arithmetic.
+(let ((fib (lambda (fib n)
+             (if (< n 2)
+                 n
+                 (+ (fib fib (- n 1)) (fib fib (- n 2)))))))
+  (fib fib 30))
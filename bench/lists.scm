@@ -0,0 +1,12 @@
+; Builds a long list and reverses it a few times, keeping it all live:
+; pair allocation, car and cdr, and collections that copy a lot.
+(let ((iota (lambda (iota n acc)
+              (if (= n 0) acc (iota iota (- n 1) (cons n acc)))))
+      (rev (lambda (rev l acc)
+             (if (null? l) acc (rev rev (cdr l) (cons (car l) acc)))))
+      (times (lambda (times f k x)
+               (if (= k 0) x (times times f (- k 1) (f x))))))
+  (car (times times
+              (lambda (l) (rev rev l '()))
+              11
+              (iota iota 200000 '()))))
@@ -0,0 +1,7 @@
+; A million-iteration tail-recursive loop. This has to run in constant
+; stack: without proper tail calls it needs more than RT_STACK_SIZE.
+(let ((loop (lambda (loop n acc)
+              (if (= n 0)
+                  acc
+                  (loop loop (- n 1) (+ acc 2))))))
+  (loop loop 1000000 0))
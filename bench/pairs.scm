@@ -0,0 +1,8 @@
+; A pair per iteration that never outlives it. Escape analysis puts it
+; in the region, so this loop should not need to collect at all.
+(let ((loop (lambda (loop n acc)
+              (if (= n 0)
+                  acc
+                  (let ((p (cons n acc)))
+                    (loop loop (- (car p) 1) (+ (cdr p) 1)))))))
+  (loop loop 1000000 0))
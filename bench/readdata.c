@@ -0,0 +1,109 @@
+/*
+ * Throughput of the C reader, in MB/s. Reads the file given on the
+ * command line or, given a number instead, generates that many
+ * megabytes of data (16 by default) in a temporary file and reads
+ * that, a few times over. Then writes what it read as a fasl file and
+ * times loading that, for comparison.
+ */
+#include "gc.h"
+#include "scgc.h"
+#include "symbol.h"
+#include "reader.h"
+#include "fasl.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define RUNS 3
+
+static const char *sample =
+    "(record %d \"a string field\" (tags alpha beta gamma)\n"
+    "        (point . (%d . -%d)) '(quoted list #t #f)) ; comment\n";
+
+static void generate(const char *path, long mb) {
+    FILE *f = fopen(path, "w");
+    long i;
+
+    assert(f);
+    for(i = 0; ftell(f) < mb << 20; i++)
+        fprintf(f, sample, (int)i, (int)(i % 1000), (int)(i % 77));
+    fclose(f);
+}
+
+static double now(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv) {
+    char tmp[] = "/tmp/flnv-readdata-XXXXXX";
+    char fasl[] = "/tmp/flnv-readfasl-XXXXXX";
+    gc_handle loaded;
+    const char *path = tmp;
+    sc_read_error err;
+    gc_handle forms;
+    struct stat st;
+    double start, elapsed, best = 0, text;
+    int i, fd;
+
+    gc_init();
+    sc_init();
+    obarray_init();
+
+    if(argc > 1 && !isdigit((unsigned char)argv[1][0])) {
+        path = argv[1];
+    } else {
+        fd = mkstemp(tmp);
+        assert(fd >= 0);
+        close(fd);
+        generate(tmp, argc > 1 ? atol(argv[1]) : 16);
+    }
+    assert(!stat(path, &st));
+
+    forms = NIL;
+    gc_register_roots(&forms, NULL);
+    for(i = 0; i < RUNS; i++) {
+        forms = NIL;
+        start = now();
+        if(sc_read_file(path, &forms, &err)) {
+            fprintf(stderr, "%s:%u:%u: %s\n", path, err.line, err.column, err.msg);
+            return 1;
+        }
+        elapsed = now() - start;
+        if(!i || elapsed < best)
+            best = elapsed;
+    }
+
+    if(path == tmp)
+        unlink(tmp);
+    printf("text: %.1fMB in %.3fs: %.1f MB/s\n",
+           st.st_size / 1048576.0, best, st.st_size / 1048576.0 / best);
+    text = best;
+
+    fd = mkstemp(fasl);
+    assert(fd >= 0);
+    assert(!sc_fasl_write(fd, forms));
+    assert(!fstat(fd, &st));
+    forms = loaded = NIL;
+    gc_register_roots(&loaded, NULL);
+    for(i = 0; i < RUNS; i++) {
+        loaded = NIL;
+        lseek(fd, 0, SEEK_SET);
+        start = now();
+        assert(!sc_fasl_read(fd, &loaded));
+        elapsed = now() - start;
+        if(!i || elapsed < best)
+            best = elapsed;
+    }
+    close(fd);
+    unlink(fasl);
+    printf("fasl: %.1fMB in %.3fs: %.1f MB/s, %.1fx as fast as text\n",
+           st.st_size / 1048576.0, best, st.st_size / 1048576.0 / best, text / best);
+    return 0;
+}
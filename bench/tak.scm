@@ -0,0 +1,10 @@
+; Takeuchi's function: deep non-tail recursion, comparisons and calls
+; with three arguments.
+(let ((tak (lambda (tak x y z)
+             (if (< y x)
+                 (tak tak
+                      (tak tak (- x 1) y z)
+                      (tak tak (- y 1) z x)
+                      (tak tak (- z 1) x y))
+                 z))))
+  (tak tak 24 16 8))
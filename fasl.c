@@ -0,0 +1,697 @@
+#include "fasl.h"
+#include "scgc.h"
+#include "graph.h"
+#include "symbol.h"
+#include "primitives.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FASL_BUFFER_SIZE        (64 * 1024)
+#define FASL_TABLE_INITIAL      256
+#define FASL_OBJECTS_INITIAL    64
+#define FASL_NAME_INITIAL       64
+
+#define FASL_MAGIC              "FLNVfasl"
+#define FASL_MAGIC_LEN          8
+#define FASL_VERSION            1
+
+/* Sanity limits on what a header may ask the loader to allocate */
+#define FASL_MAX_WORDS          (1u << 29)
+#define FASL_MAX_SYMBOLS        (1u << 24)
+#define FASL_MAX_STRING         (1u << 31)
+#define FASL_MAX_NAME           (1u << 20)
+
+/*
+ * The format. All integers are unsigned LEB128 varints.
+ *
+ *   magic, version
+ *   number of symbols, number of objects, total heap words of objects
+ *   each symbol: length of its name, then the name
+ *   each object's shape: type, then its length, or a primitive's name
+ *     as a length and the bytes
+ *   each object's contents: its fields, or a string's or raw vector's
+ *     bytes, in the host's byte order
+ *   the root
+ *
+ * Record types go in the list of objects too, though they take no
+ * heap words: their shape is the number of fields and the bitmap of
+ * which hold handles, one varint per 32 fields, and they have no
+ * contents. A record's shape is the index of its record type, which
+ * always comes before it; its contents are its fields in order, raw
+ * ones as plain varints.
+ *
+ * Fields and the root are references: a varint whose low two bits say
+ * what the rest is -- a fixnum (zigzag-encoded), nil or a boolean, the
+ * index of an object, or the index of a symbol. Since every shape
+ * comes before any contents, the loader can lay out all the objects
+ * as soon as it has read them, and a reference to any object, even
+ * one further on, resolves to its final address at once.
+ */
+
+enum fasl_ref_kind {
+    FASL_REF_FIXNUM,
+    FASL_REF_SPECIAL,
+    FASL_REF_OBJECT,
+    FASL_REF_SYMBOL
+};
+
+enum fasl_special {
+    FASL_NIL,
+    FASL_TRUE,
+    FASL_FALSE
+};
+
+enum fasl_type {
+    FASL_CONS,
+    FASL_STRING,
+    FASL_VECTOR,
+    FASL_PRIMITIVE,
+    FASL_BYTEVECTOR,
+    FASL_S64VECTOR,
+    FASL_F64VECTOR,
+    FASL_SHAPE,
+    FASL_RECORD
+};
+
+/* Writing */
+
+typedef struct fasl_out {
+    char   buf[FASL_BUFFER_SIZE];
+    size_t used;
+    int    fd;
+    int    error;
+} fasl_out;
+
+/* The table holds the objects and symbols found so far, and their indices */
+typedef struct fasl_writer {
+    fasl_out       out;
+    sc_graph_table table;
+    gc_chunk       **objects, **symbols;
+    uint32_t       nobjects, nsymbols;
+    uint32_t       objects_size, symbols_size;
+    uint64_t       words;
+} fasl_writer;
+
+static void fo_flush(fasl_out *o, const char *p, size_t n) {
+    if(!o->error)
+        o->error = sc_write_all(o->fd, p, n);
+}
+
+static void fo_bytes(fasl_out *o, const void *p, size_t n) {
+    if(o->used + n > sizeof(o->buf)) {
+        fo_flush(o, o->buf, o->used);
+        o->used = 0;
+    }
+    if(n > sizeof(o->buf)) {
+        fo_flush(o, p, n);
+        return;
+    }
+    memcpy(o->buf + o->used, p, n);
+    o->used += n;
+}
+
+static void fo_varint(fasl_out *o, uint64_t n) {
+    char bytes[10];
+    int len = 0;
+
+    while(n >= 0x80) {
+        bytes[len++] = (n & 0x7f) | 0x80;
+        n >>= 7;
+    }
+    bytes[len++] = n;
+    fo_bytes(o, bytes, len);
+}
+
+static uint32_t fw_append(gc_chunk ***list, uint32_t *n, uint32_t *size, gc_chunk *obj) {
+    if(*n == *size) {
+        *size <<= 1;
+        *list = realloc(*list, *size * sizeof(gc_chunk*));
+        assert(*list);
+    }
+    (*list)[*n] = obj;
+    return (*n)++;
+}
+
+/* Give v an index if it is an object or symbol we haven't seen yet */
+static int fw_note(fasl_writer *w, gc_handle v) {
+    gc_chunk *obj = UNTAG_PTR(v, gc_chunk);
+    uint32_t index;
+
+    if(!gc_pointerp(v) || NILP(v) || sc_booleanp(v) || sc_graph_lookup(&w->table, obj)->obj)
+        return 0;
+    if(sc_symbolp(v)) {
+        index = fw_append(&w->symbols, &w->nsymbols, &w->symbols_size, obj);
+    } else if(sc_shapep(v)) {
+        index = fw_append(&w->objects, &w->nobjects, &w->objects_size, obj);
+    } else if(sc_recordp(v)) {
+        if(fw_note(w, sc_record_shape(v)))
+            return -1;
+        index = fw_append(&w->objects, &w->nobjects, &w->objects_size, obj);
+        w->words += gc_object_len(obj);
+    } else if(sc_consp(v) || sc_stringp(v) || sc_vectorp(v) || sc_raw_vectorp(v)
+              || (sc_primitivep(v) && rt_primitive_name(sc_primitive_get(v)))) {
+        index = fw_append(&w->objects, &w->nobjects, &w->objects_size, obj);
+        w->words += gc_object_len(obj);
+    } else {
+        return -1;
+    }
+    sc_graph_insert(&w->table, obj)->value = index;
+    return 0;
+}
+
+/*
+ * Number everything reachable from v. The list of objects found so
+ * far doubles as the queue of those whose fields are still to search.
+ */
+static int fw_find(fasl_writer *w, gc_handle v) {
+    uint32_t i, j, n;
+    gc_handle obj;
+
+    if(fw_note(w, v))
+        return -1;
+    for(i = 0; i < w->nobjects; i++) {
+        obj = gc_tag_pointer(w->objects[i]);
+        if(sc_consp(obj)) {
+            if(fw_note(w, sc_car(obj)) || fw_note(w, sc_cdr(obj)))
+                return -1;
+        } else if(sc_vectorp(obj)) {
+            for(j = 0, n = sc_vector_len(obj); j < n; j++)
+                if(fw_note(w, sc_vector_ref(obj, j)))
+                    return -1;
+        } else if(sc_recordp(obj)) {
+            for(j = 0, n = sc_shape_len(sc_record_shape(obj)); j < n; j++)
+                if(sc_shape_pointer_field(sc_record_shape(obj), j)
+                   && fw_note(w, sc_record_ref(obj, j)))
+                    return -1;
+        }
+    }
+    return 0;
+}
+
+static void fw_ref(fasl_writer *w, gc_handle v) {
+    gc_int n;
+    uint64_t ref;
+
+    if(sc_numberp(v)) {
+        n = sc_number(v);
+        ref = ((uint64_t)n << 1) ^ (uint64_t)(n >> 63);
+        ref = ref << 2 | FASL_REF_FIXNUM;
+    } else if(NILP(v)) {
+        ref = FASL_NIL << 2 | FASL_REF_SPECIAL;
+    } else if(sc_booleanp(v)) {
+        ref = (v == sc_true ? FASL_TRUE : FASL_FALSE) << 2 | FASL_REF_SPECIAL;
+    } else {
+        ref = (uint64_t)sc_graph_lookup(&w->table, UNTAG_PTR(v, gc_chunk))->value << 2
+            | (sc_symbolp(v) ? FASL_REF_SYMBOL : FASL_REF_OBJECT);
+    }
+    fo_varint(&w->out, ref);
+}
+
+static void fw_shape(fasl_writer *w, gc_handle obj) {
+    fasl_out *o = &w->out;
+    const char *name;
+    sc_shape *shape;
+    uint32_t i;
+
+    if(sc_consp(obj)) {
+        fo_varint(o, FASL_CONS);
+    } else if(sc_stringp(obj)) {
+        fo_varint(o, FASL_STRING);
+        fo_varint(o, sc_strlen(obj));
+    } else if(sc_vectorp(obj)) {
+        fo_varint(o, FASL_VECTOR);
+        fo_varint(o, sc_vector_len(obj));
+    } else if(sc_bytevectorp(obj)) {
+        fo_varint(o, FASL_BYTEVECTOR);
+        fo_varint(o, sc_bytevector_len(obj));
+    } else if(sc_s64vectorp(obj)) {
+        fo_varint(o, FASL_S64VECTOR);
+        fo_varint(o, sc_s64vector_len(obj));
+    } else if(sc_f64vectorp(obj)) {
+        fo_varint(o, FASL_F64VECTOR);
+        fo_varint(o, sc_f64vector_len(obj));
+    } else if(sc_shapep(obj)) {
+        shape = UNTAG_PTR(obj, sc_shape);
+        fo_varint(o, FASL_SHAPE);
+        fo_varint(o, shape->nfields);
+        for(i = 0; i < (shape->nfields + 31) / 32; i++)
+            fo_varint(o, shape->bitmap[i]);
+    } else if(sc_recordp(obj)) {
+        fo_varint(o, FASL_RECORD);
+        fo_varint(o, sc_graph_lookup(&w->table, UNTAG_PTR(sc_record_shape(obj), gc_chunk))->value);
+    } else {
+        name = rt_primitive_name(sc_primitive_get(obj));
+        fo_varint(o, FASL_PRIMITIVE);
+        fo_varint(o, strlen(name));
+        fo_bytes(o, name, strlen(name));
+    }
+}
+
+static void fw_contents(fasl_writer *w, gc_handle obj) {
+    gc_handle shape;
+    uint32_t i, n;
+
+    if(sc_consp(obj)) {
+        fw_ref(w, sc_car(obj));
+        fw_ref(w, sc_cdr(obj));
+    } else if(sc_stringp(obj)) {
+        fo_bytes(&w->out, sc_string_get(obj), sc_strlen(obj));
+    } else if(sc_vectorp(obj)) {
+        for(i = 0, n = sc_vector_len(obj); i < n; i++)
+            fw_ref(w, sc_vector_ref(obj, i));
+    } else if(sc_bytevectorp(obj)) {
+        fo_bytes(&w->out, sc_bytevector_data(obj), sc_bytevector_len(obj));
+    } else if(sc_s64vectorp(obj)) {
+        fo_bytes(&w->out, sc_s64vector_data(obj), sc_s64vector_len(obj) * sizeof(int64_t));
+    } else if(sc_f64vectorp(obj)) {
+        fo_bytes(&w->out, sc_f64vector_data(obj), sc_f64vector_len(obj) * sizeof(double));
+    } else if(sc_recordp(obj)) {
+        shape = sc_record_shape(obj);
+        for(i = 0, n = sc_shape_len(shape); i < n; i++) {
+            if(sc_shape_pointer_field(shape, i))
+                fw_ref(w, sc_record_ref(obj, i));
+            else
+                fo_varint(&w->out, (uint32_t)sc_record_raw_ref(obj, i));
+        }
+    }
+}
+
+int sc_fasl_write(int fd, gc_handle v) {
+    fasl_writer *w;
+    const char *name;
+    uint32_t i;
+    int status = 0;
+
+    w = malloc(sizeof(fasl_writer));
+    assert(w);
+    w->out.used  = 0;
+    w->out.fd    = fd;
+    w->out.error = 0;
+    sc_graph_table_init(&w->table, FASL_TABLE_INITIAL);
+    w->nobjects = w->nsymbols = 0;
+    w->objects_size = w->symbols_size = FASL_OBJECTS_INITIAL;
+    w->objects = malloc(w->objects_size * sizeof(gc_chunk*));
+    w->symbols = malloc(w->symbols_size * sizeof(gc_chunk*));
+    w->words = 0;
+    assert(w->objects && w->symbols);
+
+    if(fw_find(w, v) || w->words > FASL_MAX_WORDS) {
+        w->out.error = EINVAL;
+    } else {
+        fo_bytes(&w->out, FASL_MAGIC, FASL_MAGIC_LEN);
+        fo_varint(&w->out, FASL_VERSION);
+        fo_varint(&w->out, w->nsymbols);
+        fo_varint(&w->out, w->nobjects);
+        fo_varint(&w->out, w->words);
+
+        for(i = 0; i < w->nsymbols; i++) {
+            name = sc_symbol_name(gc_tag_pointer(w->symbols[i]));
+            fo_varint(&w->out, strlen(name));
+            fo_bytes(&w->out, name, strlen(name));
+        }
+        for(i = 0; i < w->nobjects; i++)
+            fw_shape(w, gc_tag_pointer(w->objects[i]));
+        for(i = 0; i < w->nobjects; i++)
+            fw_contents(w, gc_tag_pointer(w->objects[i]));
+        fw_ref(w, v);
+        fo_flush(&w->out, w->out.buf, w->out.used);
+    }
+
+    if(w->out.error) {
+        errno = w->out.error;
+        status = -1;
+    }
+    sc_graph_table_free(&w->table);
+    free(w->objects);
+    free(w->symbols);
+    free(w);
+    return status;
+}
+
+/* Reading */
+
+/*
+ * Errors are sticky: once one happens, every read returns zeros, and
+ * the loader only needs to check for it where a bad value could do
+ * harm.
+ */
+typedef struct fasl_in {
+    char   buf[FASL_BUFFER_SIZE];
+    size_t pos, len;
+    int    fd;
+    int    error;
+} fasl_in;
+
+typedef struct fasl_reader {
+    fasl_in   in;
+    gc_handle symbols;          /* a vector, rooted while loading */
+    uintptr_t *base;            /* the batch holding the objects */
+    gc_handle *objects;         /* each object, in the batch or static */
+    uint32_t  nobjects, nsymbols, words;
+    char      *name;
+    size_t    name_size;
+    uint32_t  *bitmap;          /* a record type's, while reading it */
+    uint32_t  bitmap_size;
+} fasl_reader;
+
+static inline void fi_fail(fasl_in *in, int error) {
+    if(!in->error)
+        in->error = error;
+}
+
+static int fi_fill(fasl_in *in) {
+    ssize_t n;
+
+    while(!in->error) {
+        n = read(in->fd, in->buf, sizeof(in->buf));
+        if(n > 0) {
+            in->pos = 0;
+            in->len = n;
+            return 0;
+        }
+        if(n == 0)
+            fi_fail(in, EINVAL);
+        else if(errno != EINTR)
+            fi_fail(in, errno);
+    }
+    return -1;
+}
+
+/* Read n bytes straight into dst, bypassing the buffer for long runs */
+static void fi_bytes(fasl_in *in, void *dst, size_t n) {
+    char *p = dst;
+    size_t chunk;
+    ssize_t got;
+
+    while(n && !in->error) {
+        if(in->pos == in->len && n >= sizeof(in->buf)) {
+            got = read(in->fd, p, n);
+            if(got > 0) {
+                p += got;
+                n -= got;
+            } else if(got == 0) {
+                fi_fail(in, EINVAL);
+            } else if(errno != EINTR) {
+                fi_fail(in, errno);
+            }
+            continue;
+        }
+        if(in->pos == in->len && fi_fill(in))
+            break;
+        chunk = in->len - in->pos < n ? in->len - in->pos : n;
+        memcpy(p, in->buf + in->pos, chunk);
+        in->pos += chunk;
+        p += chunk;
+        n -= chunk;
+    }
+    if(in->error)
+        memset(p, 0, n);
+}
+
+static uint64_t fi_varint(fasl_in *in) {
+    uint64_t n = 0;
+    unsigned shift;
+    unsigned char b;
+
+    for(shift = 0; shift < 64; shift += 7) {
+        if(in->pos == in->len && fi_fill(in))
+            return 0;
+        b = in->buf[in->pos++];
+        n |= (uint64_t)(b & 0x7f) << shift;
+        if(!(b & 0x80))
+            return n;
+    }
+    fi_fail(in, EINVAL);
+    return 0;
+}
+
+/* A varint that must be at most max */
+static uint32_t fi_count(fasl_in *in, uint64_t max) {
+    uint64_t n = fi_varint(in);
+
+    if(n > max) {
+        fi_fail(in, EINVAL);
+        return 0;
+    }
+    return n;
+}
+
+static gc_handle fr_ref(fasl_reader *r) {
+    uint64_t ref = fi_varint(&r->in);
+    uint64_t n = ref >> 2;
+    gc_int fixnum;
+
+    switch(ref & 3) {
+    case FASL_REF_FIXNUM:
+        fixnum = (gc_int)(n >> 1) ^ -(gc_int)(n & 1);
+        if(fixnum >= FIXNUM_MIN && fixnum <= FIXNUM_MAX)
+            return sc_make_number(fixnum);
+        break;
+    case FASL_REF_SPECIAL:
+        if(n == FASL_NIL)
+            return NIL;
+        if(n == FASL_TRUE)
+            return sc_true;
+        if(n == FASL_FALSE)
+            return sc_false;
+        break;
+    case FASL_REF_OBJECT:
+        if(n < r->nobjects)
+            return r->objects[n];
+        break;
+    case FASL_REF_SYMBOL:
+        if(n < r->nsymbols)
+            return sc_vector_ref(r->symbols, n);
+        break;
+    }
+    fi_fail(&r->in, EINVAL);
+    return NIL;
+}
+
+/* A symbol's or primitive's name, as its length and then the bytes */
+static char *fr_name(fasl_reader *r) {
+    uint32_t len = fi_count(&r->in, FASL_MAX_NAME);
+
+    if(len + 1 > r->name_size) {
+        while(len + 1 > r->name_size)
+            r->name_size <<= 1;
+        r->name = realloc(r->name, r->name_size);
+        assert(r->name);
+    }
+    fi_bytes(&r->in, r->name, len);
+    r->name[len] = '\0';
+    if(strlen(r->name) != len)
+        fi_fail(&r->in, EINVAL);
+    return r->name;
+}
+
+/* Intern each symbol. This is the only part of loading that allocates. */
+static void fr_symbols(fasl_reader *r) {
+    gc_handle sym;
+    uint32_t i;
+
+    r->symbols = sc_alloc_vector(r->nsymbols);
+    for(i = 0; i < r->nsymbols && !r->in.error; i++) {
+        fr_name(r);
+        if(r->in.error)
+            break;
+        sym = sc_intern_symbol(r->name);
+        sc_vector_set(r->symbols, i, sym);
+    }
+}
+
+/* Lay out every object in the batch, with its fields still nil */
+static void fr_shapes(fasl_reader *r) {
+    uint32_t i, j, used = 0, words, len = 0;
+    uint64_t type, shape = 0;
+    sc_primitive_fn *fn = NULL;
+    void *mem;
+
+    for(i = 0; i < r->nobjects && !r->in.error; i++) {
+        type = fi_varint(&r->in);
+        switch(type) {
+        case FASL_CONS:
+            words = sc_cons_words();
+            break;
+        case FASL_STRING:
+            len = fi_count(&r->in, FASL_MAX_STRING);
+            words = sc_string_words(len);
+            break;
+        case FASL_VECTOR:
+            len = fi_count(&r->in, FASL_MAX_WORDS);
+            words = sc_vector_words(len);
+            break;
+        case FASL_BYTEVECTOR:
+            len = fi_count(&r->in, FASL_MAX_STRING);
+            words = sc_bytevector_words(len);
+            break;
+        case FASL_S64VECTOR:
+            len = fi_count(&r->in, FASL_MAX_STRING / sizeof(int64_t));
+            words = sc_s64vector_words(len);
+            break;
+        case FASL_F64VECTOR:
+            len = fi_count(&r->in, FASL_MAX_STRING / sizeof(double));
+            words = sc_f64vector_words(len);
+            break;
+        case FASL_PRIMITIVE:
+            fn = rt_find_primitive(fr_name(r));
+            if(!fn)
+                fi_fail(&r->in, EINVAL);
+            words = sc_primitive_words();
+            break;
+        case FASL_SHAPE:
+            len = fi_count(&r->in, FASL_MAX_WORDS);
+            if(len / 32 + 1 > r->bitmap_size) {
+                while(len / 32 + 1 > r->bitmap_size)
+                    r->bitmap_size <<= 1;
+                r->bitmap = realloc(r->bitmap, r->bitmap_size * sizeof(uint32_t));
+                assert(r->bitmap);
+            }
+            for(j = 0; j < (len + 31) / 32; j++)
+                r->bitmap[j] = fi_count(&r->in, UINT32_MAX);
+            words = 0;
+            break;
+        case FASL_RECORD:
+            shape = fi_varint(&r->in);
+            if(shape >= i || !sc_shapep(r->objects[shape])) {
+                fi_fail(&r->in, EINVAL);
+                return;
+            }
+            words = sc_record_words(sc_shape_len(r->objects[shape]));
+            break;
+        default:
+            fi_fail(&r->in, EINVAL);
+            return;
+        }
+        if(r->in.error || words > r->words - used) {
+            fi_fail(&r->in, EINVAL);
+            return;
+        }
+
+        mem = r->base + used;
+        used += words;
+        switch(type) {
+        case FASL_CONS:
+            r->objects[i] = sc_place_cons(mem);
+            break;
+        case FASL_STRING:
+            r->objects[i] = sc_place_string(mem, len);
+            break;
+        case FASL_VECTOR:
+            r->objects[i] = sc_place_vector(mem, len);
+            break;
+        case FASL_BYTEVECTOR:
+            r->objects[i] = sc_place_bytevector(mem, len);
+            break;
+        case FASL_S64VECTOR:
+            r->objects[i] = sc_place_s64vector(mem, len);
+            break;
+        case FASL_F64VECTOR:
+            r->objects[i] = sc_place_f64vector(mem, len);
+            break;
+        case FASL_PRIMITIVE:
+            r->objects[i] = sc_place_primitive(mem, rt_primitive_code, fn);
+            break;
+        case FASL_SHAPE:
+            r->objects[i] = sc_make_shape(len, r->bitmap);
+            break;
+        case FASL_RECORD:
+            r->objects[i] = sc_place_record(mem, r->objects[shape]);
+            break;
+        }
+    }
+    if(used != r->words)
+        fi_fail(&r->in, EINVAL);
+}
+
+static void fr_contents(fasl_reader *r) {
+    gc_handle obj, shape;
+    uint32_t i, j, n;
+
+    for(i = 0; i < r->nobjects && !r->in.error; i++) {
+        obj = r->objects[i];
+        if(sc_consp(obj)) {
+            sc_set_car(obj, fr_ref(r));
+            sc_set_cdr(obj, fr_ref(r));
+        } else if(sc_stringp(obj)) {
+            fi_bytes(&r->in, sc_string_get(obj), sc_strlen(obj));
+        } else if(sc_vectorp(obj)) {
+            for(j = 0, n = sc_vector_len(obj); j < n; j++)
+                sc_vector_set(obj, j, fr_ref(r));
+        } else if(sc_bytevectorp(obj)) {
+            fi_bytes(&r->in, sc_bytevector_data(obj), sc_bytevector_len(obj));
+        } else if(sc_s64vectorp(obj)) {
+            fi_bytes(&r->in, sc_s64vector_data(obj), sc_s64vector_len(obj) * sizeof(int64_t));
+        } else if(sc_f64vectorp(obj)) {
+            fi_bytes(&r->in, sc_f64vector_data(obj), sc_f64vector_len(obj) * sizeof(double));
+        } else if(sc_recordp(obj)) {
+            shape = sc_record_shape(obj);
+            for(j = 0, n = sc_shape_len(shape); j < n; j++) {
+                if(sc_shape_pointer_field(shape, j))
+                    sc_record_set(obj, j, fr_ref(r));
+                else
+                    sc_record_raw_set(obj, j, fi_count(&r->in, UINT32_MAX));
+            }
+        }
+    }
+}
+
+int sc_fasl_read(int fd, gc_handle *v) {
+    fasl_reader *r;
+    char magic[FASL_MAGIC_LEN];
+    gc_handle root;
+    int status = 0;
+
+    r = malloc(sizeof(fasl_reader));
+    assert(r);
+    r->in.pos = r->in.len = 0;
+    r->in.fd    = fd;
+    r->in.error = 0;
+    r->base     = NULL;
+    r->objects  = NULL;
+    r->nobjects = r->nsymbols = r->words = 0;
+    r->name_size = FASL_NAME_INITIAL;
+    r->name = malloc(r->name_size);
+    r->bitmap_size = 1;
+    r->bitmap = malloc(r->bitmap_size * sizeof(uint32_t));
+    assert(r->name && r->bitmap);
+    r->symbols = NIL;
+    gc_register_roots(&r->symbols, NULL);
+
+    fi_bytes(&r->in, magic, FASL_MAGIC_LEN);
+    if(memcmp(magic, FASL_MAGIC, FASL_MAGIC_LEN) || fi_varint(&r->in) != FASL_VERSION)
+        fi_fail(&r->in, EINVAL);
+    r->nsymbols = fi_count(&r->in, FASL_MAX_SYMBOLS);
+    r->nobjects = fi_count(&r->in, FASL_MAX_WORDS);
+    r->words    = fi_count(&r->in, FASL_MAX_WORDS);
+
+    if(!r->in.error)
+        fr_symbols(r);
+
+    /* From here on nothing allocates, so the batch can't move */
+    if(!r->in.error && r->nobjects) {
+        r->objects = malloc(r->nobjects * sizeof(gc_handle));
+        assert(r->objects);
+        r->base = gc_alloc_batch(r->words);
+        fr_shapes(r);
+        fr_contents(r);
+    } else if(r->words) {
+        fi_fail(&r->in, EINVAL);
+    }
+    root = fr_ref(r);
+
+    if(r->in.error) {
+        errno = r->in.error;
+        status = -1;
+    } else {
+        *v = root;
+    }
+    gc_pop_roots();
+    free(r->objects);
+    free(r->name);
+    free(r->bitmap);
+    free(r);
+    return status;
+}
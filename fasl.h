@@ -0,0 +1,35 @@
+#ifndef __FLNV_FASL_H__
+#define __FLNV_FASL_H__
+
+#include "gc.h"
+
+/*
+ * A binary format for object graphs, for caching data on disk and
+ * passing it between processes; much faster to load than text.
+ *
+ * Every type in scgc.c but closures is covered, and sharing and
+ * cycles survive the trip. Symbols are written once each by name and
+ * interned again on loading, so they stay eq to the loader's own.
+ * Record types are written by layout, and each one loads as a new
+ * type. Primitives are written by name and looked up with
+ * rt_find_primitive on loading. Closures can't be written at all: their
+ * code means nothing to another process.
+ *
+ * Both directions stream through a fixed buffer. Loading reads the
+ * input once and allocates every object in a single batch.
+ */
+
+/*
+ * Write v to fd. Returns 0, or -1 with errno set -- EINVAL if v holds
+ * a closure or a primitive that rt_find_primitive doesn't know.
+ */
+int sc_fasl_write(int fd, gc_handle v);
+
+/*
+ * Read a graph written by sc_fasl_write from fd into *v. Returns 0, or
+ * -1 with errno set -- EINVAL for data that isn't a well-formed graph.
+ * It reads ahead, so data after the graph may be consumed.
+ */
+int sc_fasl_read(int fd, gc_handle *v);
+
+#endif
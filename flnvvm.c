@@ -0,0 +1,51 @@
+/*
+ * Runs a program compiled by flnvbc: flnvvm prog.fbc
+ */
+#include "vm.h"
+#include "scgc.h"
+#include "symbol.h"
+#include "reader.h"
+#include "primitives.h"
+
+#include <stdio.h>
+#include <sys/time.h>
+
+int main(int argc, char **argv) {
+    struct timeval start;
+    sc_read_error err;
+    const char *msg;
+    vm_program *prog;
+    gc_handle forms, val;
+
+    if(argc != 2) {
+        fprintf(stderr, "Usage: %s program.fbc\n", argv[0]);
+        return 1;
+    }
+
+    gettimeofday(&start, NULL);
+
+    gc_init();
+    sc_init();
+    obarray_init();
+    vm_init();
+
+    if(sc_read_file(argv[1], &forms, &err) < 0) {
+        if(err.line)
+            fprintf(stderr, "%s:%u:%u: %s\n", argv[1], err.line, err.column, err.msg);
+        else
+            fprintf(stderr, "%s: %s\n", argv[1], err.msg);
+        return 1;
+    }
+    if(NILP(forms) || !(prog = vm_load(sc_car(forms), &msg))) {
+        fprintf(stderr, "%s: %s\n", argv[1], NILP(forms) ? "empty image" : msg);
+        return 1;
+    }
+
+    val = vm_run(prog);
+    rt_display(val);
+    putchar('\n');
+
+    rt_report_stats(&start);
+    vm_free(prog);
+    return 0;
+}
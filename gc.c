@@ -3,6 +3,7 @@
 #include <malloc.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <sys/mman.h>
 
 /* Constants */
 #define GC_INITIAL_MEM  1024
@@ -11,13 +12,17 @@
 
 static uintptr_t *working_mem = NULL;
 static uintptr_t *free_mem    = NULL;
-static uintptr_t *free_ptr    = NULL;
+uintptr_t *free_ptr          = NULL;
+uintptr_t *heap_limit        = NULL;
 static uintptr_t mem_size;
 
 #ifdef TEST_STRESS_GC
 static int in_gc = 0;
 #endif
 
+/* Set FLNV_STATS in the environment to trace collections on stderr */
+static int gc_trace = 0;
+
 static gc_handle gc_root_stack;
 static gc_handle gc_root_hooks;
 
@@ -25,7 +30,7 @@ static uint32_t gc_n_temp_roots = 0;
 static gc_handle *gc_temp_roots[MAX_EXTERNAL_ROOTS_FRAME];
 
 void *_gc_try_alloc(uint32_t n) {
-    if(free_ptr - working_mem + n <= mem_size) {
+    if(free_ptr + n <= heap_limit) {
         void *h = free_ptr;
         free_ptr += n;
         return h;
@@ -65,26 +70,59 @@ void *gc_alloc(gc_ops *ops, uint32_t n) {
     return handle;
 }
 
+void *gc_alloc_batch(uint32_t n) {
+    return _gc_alloc(n);
+}
+
 void gc_relocate_root(void);
 
+/*
+ * gc_handle's are only 32 bits wide, so on 64-bit hosts the heap has
+ * to live in the low 2GB of the address space for tagged pointers to
+ * survive the round trip.
+ */
+static uintptr_t *gc_alloc_space(uint32_t words) {
+    uintptr_t *space;
+#ifdef MAP_32BIT
+    space = mmap(NULL, words * sizeof(uintptr_t), PROT_READ|PROT_WRITE,
+                 MAP_PRIVATE|MAP_ANONYMOUS|MAP_32BIT, -1, 0);
+    assert(space != MAP_FAILED);
+#else
+    space = malloc(words * sizeof(uintptr_t));
+#endif
+    assert(!(((uintptr_t)space) & 0x3));
+    return space;
+}
+
+uintptr_t *gc_alloc_region(uint32_t words) {
+    return gc_alloc_space(words);
+}
+
+static void gc_free_space(uintptr_t *space, uint32_t words) {
+#ifdef MAP_32BIT
+    munmap(space, words * sizeof(uintptr_t));
+#else
+    free(space);
+#endif
+}
+
 /* GC control */
 void gc_init() {
     if(free_mem) {
-        free(free_mem);
-        free(working_mem);
+        gc_free_space(free_mem, mem_size);
+        gc_free_space(working_mem, mem_size);
     }
-    free_mem = malloc(GC_INITIAL_MEM * sizeof(uintptr_t));
-    working_mem = malloc(GC_INITIAL_MEM * sizeof(uintptr_t));
-
-    assert(!(((uintptr_t)free_mem) & 0x3));
-    assert(!(((uintptr_t)working_mem) & 0x3));
+    free_mem = gc_alloc_space(GC_INITIAL_MEM);
+    working_mem = gc_alloc_space(GC_INITIAL_MEM);
 
     free_ptr = working_mem;
     mem_size = GC_INITIAL_MEM;
+    heap_limit = working_mem + mem_size;
 
     gc_root_hooks = NIL;
     gc_root_stack = NIL;
     gc_n_temp_roots = 0;
+    gc_trace = getenv("FLNV_STATS") != NULL;
 
     gc_register_gc_root_hook(gc_relocate_root);
 }
@@ -114,7 +152,7 @@ static void gc_relocate_external_roots(gc_external_roots *v) {
 }
 
 static uint32_t gc_len_external_roots(gc_external_roots *v) {
-    return v->nroots + sizeof(gc_external_roots)/sizeof(gc_handle);
+    return GC_WORDS(sizeof(gc_external_roots) + v->nroots * sizeof(gc_handle*));
 }
 
 static gc_ops gc_external_root_ops = {
@@ -139,7 +177,8 @@ void gc_register_roots(gc_handle* root0, ...) {
      * until we've safely registered them. Use _try_alloc to try to
      * put them in the heap without risking a GC.
      */
-    frame = (gc_external_roots*)_gc_try_alloc(3 + nroots);
+    frame = (gc_external_roots*)_gc_try_alloc(
+        GC_WORDS(sizeof(gc_external_roots) + nroots * sizeof(gc_handle*)));
 
     if(!frame) {
         /*
@@ -154,7 +193,8 @@ void gc_register_roots(gc_handle* root0, ...) {
             gc_temp_roots[i++] = va_arg(ap, gc_handle*);
         va_end(ap);
         gc_n_temp_roots = nroots;
-        frame = (gc_external_roots*)_gc_alloc(3 + nroots);
+        frame = (gc_external_roots*)_gc_alloc(
+            GC_WORDS(sizeof(gc_external_roots) + nroots * sizeof(gc_handle*)));
         gc_n_temp_roots = 0;
     }
 
@@ -191,7 +231,7 @@ static void gc_relocate_root_hook(gc_root_hook *hook) {
 }
 
 static uint32_t gc_len_root_hook(gc_chunk *chunk) {
-    return sizeof(gc_root_hook)/sizeof(gc_handle);
+    return GC_WORDS(sizeof(gc_root_hook));
 }
 
 static struct gc_ops gc_root_hook_ops = {
@@ -200,12 +240,35 @@ static struct gc_ops gc_root_hook_ops = {
 };
 
 void gc_register_gc_root_hook(gc_hook *hook_fun) {
-    gc_root_hook *hook = (gc_root_hook*)gc_alloc(&gc_root_hook_ops, 3);
+    gc_root_hook *hook = (gc_root_hook*)gc_alloc(&gc_root_hook_ops,
+                                                 GC_WORDS(sizeof(gc_root_hook)));
     hook->next = gc_root_hooks;
     hook->hook = hook_fun;
     gc_root_hooks = gc_tag_pointer(hook);
 }
 
+/*
+ * During a collection free_mem is the space we are evacuating; anything
+ * else, including NIL and objects outside the heap, stays put.
+ */
+static inline int gc_in_from_space(gc_chunk *val) {
+    return (uintptr_t*)val >= free_mem
+        && (uintptr_t*)val < (free_mem + mem_size);
+}
+
+static inline int gc_in_to_space(gc_chunk *val) {
+    return (uintptr_t*)val >= working_mem
+        && (uintptr_t*)val < (working_mem + mem_size);
+}
+
+uint32_t gc_object_len(gc_chunk *obj) {
+    return obj->ops->op_len(obj);
+}
+
+void gc_relocate_object(gc_chunk *obj) {
+    obj->ops->op_relocate(obj);
+}
+
 void gc_relocate(gc_handle *v) {
     int len;
     uintptr_t *reloc;
@@ -215,8 +278,9 @@ void gc_relocate(gc_handle *v) {
         return;
     val = UNTAG_PTR(*v, gc_chunk);
 
-    if((uintptr_t*)val < free_mem
-       || (uintptr_t*)val >= (free_mem + mem_size)) {
+    if(!gc_in_from_space(val)) {
+        if(val && !gc_in_to_space(val) && val->ops->op_mark)
+            val->ops->op_mark(val);
         return;
     }
 
@@ -258,13 +322,12 @@ void gc_protect_roots() {
 
 void gc_gc() {
     uint32_t old_avail = gc_free_mem();
-    printf("Entering garbage collection...");
-    uint32_t *scan;
-    uint32_t *t;
+    uintptr_t *scan;
+    uintptr_t *t;
 
 #ifdef TEST_STRESS_GC
     if(in_gc) {
-        printf("GC internal error -- recursive GC!\n");
+        fprintf(stderr, "GC internal error -- recursive GC!\n");
         abort();
     }
     in_gc = 1;
@@ -275,6 +338,7 @@ void gc_gc() {
     free_mem = t;
 
     scan = free_ptr = working_mem;
+    heap_limit = working_mem + mem_size;
 
     gc_protect_roots();
 
@@ -287,7 +351,7 @@ void gc_gc() {
         scan += chunk->ops->op_len(chunk);
 
         if(scan > working_mem + mem_size) {
-            printf("GC internal error -- ran off the end of memory!\n");
+            fprintf(stderr, "GC internal error -- ran off the end of memory!\n");
             abort();
         }
     }
@@ -301,25 +365,25 @@ void gc_gc() {
        holds onto gc_handle's during GC.*/
     memset(free_mem, 0, sizeof(uintptr_t) * mem_size);
 #endif
-    printf("Done (freed %d words)\n", gc_free_mem() - old_avail);
+    if(gc_trace)
+        fprintf(stderr, "GC freed %d words\n", gc_free_mem() - old_avail);
 }
 
 void gc_realloc(uint32_t need) {
-    printf("GC realloc forced!\n");
     uint32_t new_size = mem_size;
     while(new_size - mem_size < need) new_size <<= 1;
-    printf("New memory: %d words\n", new_size);
+    if(gc_trace)
+        fprintf(stderr, "GC realloc forced, new memory: %d words\n", new_size);
 
-    free(free_mem);
-    free_mem = malloc(new_size * sizeof(uintptr_t));
-    assert(!(((uintptr_t)free_mem) & 0x3));
+    gc_free_space(free_mem, mem_size);
+    free_mem = gc_alloc_space(new_size);
 
     gc_gc();
 
-    free(free_mem);
+    gc_free_space(free_mem, mem_size);
     mem_size = new_size;
-    free_mem = malloc(mem_size * sizeof(uintptr_t));
-    assert(!(((uintptr_t)free_mem) & 0x3));
+    heap_limit = working_mem + mem_size;
+    free_mem = gc_alloc_space(mem_size);
 }
 
 
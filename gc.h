@@ -24,6 +24,7 @@ typedef uint32_t (*gc_len_op)(gc_chunk*);
 typedef struct gc_ops {
     gc_relocate_op op_relocate;
     gc_len_op op_len;
+    gc_relocate_op op_mark;     /* optional, see below */
 } gc_ops;
 
 typedef void gc_hook(void);
@@ -36,6 +37,13 @@ void gc_init();
 
 void *gc_alloc(gc_ops *ops, uint32_t len);
 
+/*
+ * Allocate room for several objects with a single check for space.
+ * The caller must lay out objects with valid headers over all of it
+ * before it next allocates, so that the collector can walk it.
+ */
+void *gc_alloc_batch(uint32_t len);
+
 void gc_realloc(uint32_t need_mem);
 void gc_gc();
 uint32_t gc_free_mem();
@@ -46,11 +54,49 @@ void gc_pop_roots();
 
 void gc_register_gc_root_hook(gc_hook *);
 
+/*
+ * Objects outside the heap.
+ *
+ * A handle may point to an object outside the GC heap, in memory the
+ * mutator manages itself, as long as the object starts with a valid
+ * gc_chunk header. The collector never copies such objects and leaves
+ * handles to them unchanged. Nor does it look inside them: whoever
+ * owns them must call gc_relocate_object on each one from a root hook
+ * for as long as it may hold handles into the heap.
+ *
+ * If such an object's ops have an op_mark, a collection calls it for
+ * each handle to the object that it finds, so that the owner can tell
+ * which ones are still in use.
+ *
+ * Static objects are those outside the heap that are never freed and
+ * only hold immediates or handles to other static objects, such as
+ * the constants the compiler lays out in the executable. They can
+ * never point into the heap, so they need no scanning at all.
+ *
+ * gc_alloc_region returns memory for such objects that handles can
+ * address; it is never freed.
+ */
+uintptr_t *gc_alloc_region(uint32_t words);
+uint32_t gc_object_len(gc_chunk *obj);
+void gc_relocate_object(gc_chunk *obj);
+
+/*
+ * The allocation pointer and the end of the current semispace.
+ * Exported so that compiled code can inline bump-pointer allocation,
+ * falling back to gc_alloc when free_ptr would pass heap_limit.
+ */
+extern uintptr_t *free_ptr;
+extern uintptr_t *heap_limit;
+
 #define TAG_BITS     2
 #define TAG_MASK     0x03
 #define NUMBER_TAG   0x01
 #define POINTER_TAG  0x02
 
+/* The range of numbers a handle can hold */
+#define FIXNUM_MIN   (-((gc_int)1 << (31 - TAG_BITS)))
+#define FIXNUM_MAX   (((gc_int)1 << (31 - TAG_BITS)) - 1)
+
 /* Here be demons */
 static inline gc_handle gc_tag_number(gc_int n) {
     return (n << TAG_BITS) | NUMBER_TAG;
@@ -70,10 +116,10 @@ static inline int gc_pointerp(gc_handle h) {
 }
 
 static inline gc_int gc_untag_number(gc_handle h) {
-    return (h >> TAG_BITS);
+    return ((int32_t)h) >> TAG_BITS;
 }
 
-#define UNTAG_PTR(c, t) ((t*)(c & ~TAG_MASK))
+#define UNTAG_PTR(c, t) ((t*)(uintptr_t)((c) & ~TAG_MASK))
 
 #define MAX(a,b)                          \
     ({  typeof (a) _a = (a);              \
@@ -94,6 +140,9 @@ static inline gc_int gc_untag_number(gc_handle h) {
         (typeof(a)) (ROUNDDOWN((uint32_t) (a) + __n - 1, __n)); \
 })
 
+// Size in heap words of an object occupying `bytes' bytes
+#define GC_WORDS(bytes) (ROUNDUP((uint32_t)(bytes), sizeof(uintptr_t))/sizeof(uintptr_t))
+
 #define NIL          (gc_tag_pointer(NULL))
 #define NILP(x)      ((x) == NIL)
 
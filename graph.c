@@ -0,0 +1,64 @@
+#include "graph.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+void sc_graph_table_init(sc_graph_table *t, uint32_t size) {
+    t->size    = size;
+    t->count   = 0;
+    t->entries = calloc(size, sizeof(sc_graph_entry));
+    assert(t->entries);
+}
+
+void sc_graph_table_free(sc_graph_table *t) {
+    free(t->entries);
+    t->entries = NULL;
+}
+
+static inline uint32_t sc_graph_hash(gc_chunk *obj) {
+    return (uint32_t)(((uintptr_t)obj >> 3) * 2654435761u);
+}
+
+sc_graph_entry *sc_graph_lookup(sc_graph_table *t, gc_chunk *obj) {
+    uint32_t i = sc_graph_hash(obj) & (t->size - 1);
+
+    while(t->entries[i].obj && t->entries[i].obj != obj)
+        i = (i + 1) & (t->size - 1);
+    return &t->entries[i];
+}
+
+sc_graph_entry *sc_graph_insert(sc_graph_table *t, gc_chunk *obj) {
+    sc_graph_entry *old = t->entries, *e;
+    uint32_t i, size = t->size;
+
+    if(2 * (t->count + 1) > t->size) {
+        t->size <<= 1;
+        t->entries = calloc(t->size, sizeof(sc_graph_entry));
+        assert(t->entries);
+        for(i = 0; i < size; i++)
+            if(old[i].obj)
+                *sc_graph_lookup(t, old[i].obj) = old[i];
+        free(old);
+    }
+    e = sc_graph_lookup(t, obj);
+    e->obj   = obj;
+    e->flags = 0;
+    e->value = 0;
+    t->count++;
+    return e;
+}
+
+int sc_write_all(int fd, const char *p, size_t n) {
+    ssize_t done;
+
+    while(n) {
+        done = write(fd, p, n);
+        if(done < 0 && errno != EINTR) {
+            return errno;
+        } else if(done > 0) {
+            p += done;
+            n -= done;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef __FLNV_GRAPH_H__
+#define __FLNV_GRAPH_H__
+
+#include <stddef.h>
+
+#include "gc.h"
+
+/*
+ * Helpers shared by the writer and fasl, which walk an object graph
+ * and stream it out to a file descriptor.
+ *
+ * A graph table records what has been found of each object so far, by
+ * address. It is only valid while the collector can't run, since a
+ * collection moves everything.
+ */
+
+typedef struct sc_graph_entry {
+    gc_chunk *obj;              /* NULL in an empty slot */
+    uint32_t flags;
+    uint32_t value;
+} sc_graph_entry;
+
+typedef struct sc_graph_table {
+    sc_graph_entry *entries;
+    uint32_t size, count;       /* size is a power of 2 */
+} sc_graph_table;
+
+void sc_graph_table_init(sc_graph_table *t, uint32_t size);
+void sc_graph_table_free(sc_graph_table *t);
+
+/* obj's entry, or the empty slot it would go in */
+sc_graph_entry *sc_graph_lookup(sc_graph_table *t, gc_chunk *obj);
+
+/* A new entry for obj, which mustn't have one, with flags and value 0 */
+sc_graph_entry *sc_graph_insert(sc_graph_table *t, gc_chunk *obj);
+
+/*
+ * Write all n bytes at p to fd, retrying short writes. Returns 0, or
+ * the errno of the write that failed.
+ */
+int sc_write_all(int fd, const char *p, size_t n);
+
+#endif
@@ -0,0 +1,578 @@
+#include "primitives.h"
+#include "scgc.h"
+#include "writer.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+/* Errors */
+
+void rt_error(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "Error: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(3);
+}
+
+void rt_error_arity(uint32_t argc) {
+    rt_error("Wrong number of arguments (%d)", argc);
+}
+
+static gc_int rt_check_number(gc_handle v) {
+    if(!sc_numberp(v))
+        rt_error("Not a number");
+    return sc_number(v);
+}
+
+static gc_handle rt_check_cons(gc_handle v) {
+    if(!sc_consp(v))
+        rt_error("Not a pair");
+    return v;
+}
+
+static void rt_check_argc(uint32_t argc, uint32_t want) {
+    if(argc != want)
+        rt_error_arity(argc);
+}
+
+/* An index or count in [0, limit] */
+static uint32_t rt_check_index(gc_handle v, uint32_t limit) {
+    gc_int n = rt_check_number(v);
+    if(n < 0 || n > limit)
+        rt_error("Index out of range");
+    return n;
+}
+
+/* An arithmetic result, which must fit in a fixnum */
+static gc_int rt_check_fixnum(gc_int n) {
+    if(n < FIXNUM_MIN || n > FIXNUM_MAX)
+        rt_error("Fixnum overflow");
+    return n;
+}
+
+static inline gc_handle rt_boolean(int b) {
+    return b ? sc_true : sc_false;
+}
+
+/* Primitives */
+
+static gc_handle prim_add(gc_handle *argv, uint32_t argc) {
+    gc_int sum = 0;
+    uint32_t i;
+    for(i = 0; i < argc; i++)
+        sum += rt_check_number(argv[i]);
+    return sc_make_number(rt_check_fixnum(sum));
+}
+
+static gc_handle prim_sub(gc_handle *argv, uint32_t argc) {
+    gc_int diff;
+    uint32_t i;
+    if(argc == 0)
+        rt_error_arity(argc);
+    diff = rt_check_number(argv[0]);
+    if(argc == 1)
+        return sc_make_number(rt_check_fixnum(-diff));
+    for(i = 1; i < argc; i++)
+        diff -= rt_check_number(argv[i]);
+    return sc_make_number(rt_check_fixnum(diff));
+}
+
+static gc_handle prim_mul(gc_handle *argv, uint32_t argc) {
+    gc_int prod = 1, n;
+    int overflow = 0, zero = 0;
+    uint32_t i;
+    for(i = 0; i < argc; i++) {
+        n = rt_check_number(argv[i]);
+        zero |= n == 0;
+        overflow |= __builtin_mul_overflow(prod, n, &prod);
+    }
+    if(overflow && !zero)
+        rt_error("Fixnum overflow");
+    return sc_make_number(rt_check_fixnum(prod));
+}
+
+static gc_handle prim_num_eq(gc_handle *argv, uint32_t argc) {
+    rt_check_argc(argc, 2);
+    return rt_boolean(rt_check_number(argv[0]) == rt_check_number(argv[1]));
+}
+
+static gc_handle prim_lt(gc_handle *argv, uint32_t argc) {
+    rt_check_argc(argc, 2);
+    return rt_boolean(rt_check_number(argv[0]) < rt_check_number(argv[1]));
+}
+
+static gc_handle prim_gt(gc_handle *argv, uint32_t argc) {
+    rt_check_argc(argc, 2);
+    return rt_boolean(rt_check_number(argv[0]) > rt_check_number(argv[1]));
+}
+
+static gc_handle prim_cons(gc_handle *argv, uint32_t argc) {
+    gc_handle c;
+    rt_check_argc(argc, 2);
+    c = sc_alloc_cons();
+    sc_set_car(c, argv[0]);
+    sc_set_cdr(c, argv[1]);
+    return c;
+}
+
+static gc_handle prim_car(gc_handle *argv, uint32_t argc) {
+    rt_check_argc(argc, 1);
+    return sc_car(rt_check_cons(argv[0]));
+}
+
+static gc_handle prim_cdr(gc_handle *argv, uint32_t argc) {
+    rt_check_argc(argc, 1);
+    return sc_cdr(rt_check_cons(argv[0]));
+}
+
+static gc_handle prim_nullp(gc_handle *argv, uint32_t argc) {
+    rt_check_argc(argc, 1);
+    return rt_boolean(NILP(argv[0]));
+}
+
+static gc_handle prim_pairp(gc_handle *argv, uint32_t argc) {
+    rt_check_argc(argc, 1);
+    return rt_boolean(sc_consp(argv[0]));
+}
+
+static gc_handle prim_eqp(gc_handle *argv, uint32_t argc) {
+    rt_check_argc(argc, 2);
+    return rt_boolean(argv[0] == argv[1]);
+}
+
+static gc_handle prim_not(gc_handle *argv, uint32_t argc) {
+    rt_check_argc(argc, 1);
+    return rt_boolean(argv[0] == sc_false);
+}
+
+static gc_handle prim_display(gc_handle *argv, uint32_t argc) {
+    rt_check_argc(argc, 1);
+    rt_display(argv[0]);
+    return argv[0];
+}
+
+/*
+ * Bytevectors, s64vectors and f64vectors, with the SRFI 4 and R7RS
+ * operations. Elements go in and out as fixnums; since there are no
+ * flonums yet, f64vectors can be filled and copied but not read.
+ */
+
+typedef struct rt_raw_type {
+    int       (*p)(gc_handle);
+    gc_handle (*alloc)(uint32_t);
+    uint32_t  (*len)(gc_handle);
+    size_t    size;
+    const char *error;
+} rt_raw_type;
+
+static const rt_raw_type rt_bytevector = {
+    sc_bytevectorp, sc_alloc_bytevector, sc_bytevector_len, sizeof(uint8_t), "Not a bytevector"
+};
+static const rt_raw_type rt_s64vector = {
+    sc_s64vectorp, sc_alloc_s64vector, sc_s64vector_len, sizeof(int64_t), "Not an s64vector"
+};
+static const rt_raw_type rt_f64vector = {
+    sc_f64vectorp, sc_alloc_f64vector, sc_f64vector_len, sizeof(double), "Not an f64vector"
+};
+
+static gc_handle rt_check_raw(gc_handle v, const rt_raw_type *t) {
+    if(!t->p(v))
+        rt_error("%s", t->error);
+    return v;
+}
+
+static uint8_t rt_check_byte(gc_handle v) {
+    gc_int n = rt_check_number(v);
+    if(n < 0 || n > 255)
+        rt_error("Not a byte");
+    return n;
+}
+
+/* The index of an element of v */
+static uint32_t rt_raw_index(gc_handle v, gc_handle i, const rt_raw_type *t) {
+    gc_int n = rt_check_number(i);
+    if(n < 0 || n >= t->len(rt_check_raw(v, t)))
+        rt_error("Index out of range");
+    return n;
+}
+
+/* Fill v with x, between the optional bounds in argv[first] on */
+static void rt_raw_fill(gc_handle v, const rt_raw_type *t, gc_handle x,
+                        gc_handle *argv, uint32_t argc, uint32_t first) {
+    uint32_t len = t->len(v);
+    uint32_t end = argc > first + 1 ? rt_check_index(argv[first + 1], len) : len;
+    uint32_t start = argc > first ? rt_check_index(argv[first], end) : 0;
+
+    if(t == &rt_bytevector)
+        sc_bytevector_fill(v, rt_check_byte(x), start, end);
+    else if(t == &rt_s64vector)
+        sc_s64vector_fill(v, rt_check_number(x), start, end);
+    else
+        sc_f64vector_fill(v, rt_check_number(x), start, end);
+}
+
+/* (make-<type> len [fill]) */
+static gc_handle rt_make_raw(gc_handle *argv, uint32_t argc, const rt_raw_type *t) {
+    gc_handle v;
+    uint32_t len;
+
+    if(argc < 1 || argc > 2)
+        rt_error_arity(argc);
+    len = rt_check_index(argv[0], FIXNUM_MAX / t->size);
+    v = t->alloc(len);
+    if(argc == 2)
+        rt_raw_fill(v, t, argv[1], argv, 0, 0);
+    return v;
+}
+
+static gc_handle rt_raw_length(gc_handle *argv, uint32_t argc, const rt_raw_type *t) {
+    rt_check_argc(argc, 1);
+    return sc_make_number(t->len(rt_check_raw(argv[0], t)));
+}
+
+/* (<type>-fill! v x [start [end]]) */
+static gc_handle rt_raw_fill_prim(gc_handle *argv, uint32_t argc, const rt_raw_type *t) {
+    if(argc < 2 || argc > 4)
+        rt_error_arity(argc);
+    rt_raw_fill(rt_check_raw(argv[0], t), t, argv[1], argv, argc, 2);
+    return argv[0];
+}
+
+/* (<type>-copy! to at from [start [end]]) */
+static gc_handle rt_raw_copy(gc_handle *argv, uint32_t argc, const rt_raw_type *t) {
+    uint32_t at, start, end;
+
+    if(argc < 3 || argc > 5)
+        rt_error_arity(argc);
+    at  = rt_check_index(argv[1], t->len(rt_check_raw(argv[0], t)));
+    end = t->len(rt_check_raw(argv[2], t));
+    if(argc > 4)
+        end = rt_check_index(argv[4], end);
+    start = argc > 3 ? rt_check_index(argv[3], end) : 0;
+    if(end - start > t->len(argv[0]) - at)
+        rt_error("Index out of range");
+    sc_raw_vector_copy(argv[0], at, argv[2], start, end);
+    return argv[0];
+}
+
+static gc_handle prim_make_bytevector(gc_handle *argv, uint32_t argc) {
+    return rt_make_raw(argv, argc, &rt_bytevector);
+}
+
+static gc_handle prim_bytevectorp(gc_handle *argv, uint32_t argc) {
+    rt_check_argc(argc, 1);
+    return rt_boolean(sc_bytevectorp(argv[0]));
+}
+
+static gc_handle prim_bytevector_length(gc_handle *argv, uint32_t argc) {
+    return rt_raw_length(argv, argc, &rt_bytevector);
+}
+
+static gc_handle prim_bytevector_ref(gc_handle *argv, uint32_t argc) {
+    uint32_t i;
+    rt_check_argc(argc, 2);
+    i = rt_raw_index(argv[0], argv[1], &rt_bytevector);
+    return sc_make_number(sc_bytevector_data(argv[0])[i]);
+}
+
+static gc_handle prim_bytevector_set(gc_handle *argv, uint32_t argc) {
+    uint32_t i;
+    rt_check_argc(argc, 3);
+    i = rt_raw_index(argv[0], argv[1], &rt_bytevector);
+    sc_bytevector_data(argv[0])[i] = rt_check_byte(argv[2]);
+    return argv[2];
+}
+
+static gc_handle prim_bytevector_fill(gc_handle *argv, uint32_t argc) {
+    return rt_raw_fill_prim(argv, argc, &rt_bytevector);
+}
+
+static gc_handle prim_bytevector_copy(gc_handle *argv, uint32_t argc) {
+    return rt_raw_copy(argv, argc, &rt_bytevector);
+}
+
+static gc_handle prim_make_s64vector(gc_handle *argv, uint32_t argc) {
+    return rt_make_raw(argv, argc, &rt_s64vector);
+}
+
+static gc_handle prim_s64vectorp(gc_handle *argv, uint32_t argc) {
+    rt_check_argc(argc, 1);
+    return rt_boolean(sc_s64vectorp(argv[0]));
+}
+
+static gc_handle prim_s64vector_length(gc_handle *argv, uint32_t argc) {
+    return rt_raw_length(argv, argc, &rt_s64vector);
+}
+
+static gc_handle prim_s64vector_ref(gc_handle *argv, uint32_t argc) {
+    uint32_t i;
+    int64_t x;
+    rt_check_argc(argc, 2);
+    i = rt_raw_index(argv[0], argv[1], &rt_s64vector);
+    x = sc_s64vector_data(argv[0])[i];
+    if(x < FIXNUM_MIN || x > FIXNUM_MAX)
+        rt_error("Element too big for a fixnum");
+    return sc_make_number(x);
+}
+
+static gc_handle prim_s64vector_set(gc_handle *argv, uint32_t argc) {
+    uint32_t i;
+    rt_check_argc(argc, 3);
+    i = rt_raw_index(argv[0], argv[1], &rt_s64vector);
+    sc_s64vector_data(argv[0])[i] = rt_check_number(argv[2]);
+    return argv[2];
+}
+
+static gc_handle prim_s64vector_fill(gc_handle *argv, uint32_t argc) {
+    return rt_raw_fill_prim(argv, argc, &rt_s64vector);
+}
+
+static gc_handle prim_s64vector_copy(gc_handle *argv, uint32_t argc) {
+    return rt_raw_copy(argv, argc, &rt_s64vector);
+}
+
+static gc_handle prim_make_f64vector(gc_handle *argv, uint32_t argc) {
+    return rt_make_raw(argv, argc, &rt_f64vector);
+}
+
+static gc_handle prim_f64vectorp(gc_handle *argv, uint32_t argc) {
+    rt_check_argc(argc, 1);
+    return rt_boolean(sc_f64vectorp(argv[0]));
+}
+
+static gc_handle prim_f64vector_length(gc_handle *argv, uint32_t argc) {
+    return rt_raw_length(argv, argc, &rt_f64vector);
+}
+
+static gc_handle prim_f64vector_set(gc_handle *argv, uint32_t argc) {
+    uint32_t i;
+    rt_check_argc(argc, 3);
+    i = rt_raw_index(argv[0], argv[1], &rt_f64vector);
+    sc_f64vector_data(argv[0])[i] = rt_check_number(argv[2]);
+    return argv[2];
+}
+
+static gc_handle prim_f64vector_fill(gc_handle *argv, uint32_t argc) {
+    return rt_raw_fill_prim(argv, argc, &rt_f64vector);
+}
+
+static gc_handle prim_f64vector_copy(gc_handle *argv, uint32_t argc) {
+    return rt_raw_copy(argv, argc, &rt_f64vector);
+}
+
+/*
+ * Records. (make-record-type n raw) makes a shape with n fields, of
+ * which those whose indices are in the list raw hold untagged fixnums;
+ * the rest hold any value. The accessors take the record type as well
+ * as the record, so that the compilers can open-code them with a
+ * single check of the record's header.
+ */
+
+static gc_handle rt_check_record(gc_handle type, gc_handle r) {
+    if(!sc_shapep(type))
+        rt_error("Not a record type");
+    if(!sc_recordp(r) || sc_record_shape(r) != type)
+        rt_error("Not a record of this type");
+    return r;
+}
+
+static gc_handle prim_make_record_type(gc_handle *argv, uint32_t argc) {
+    uint32_t n, i, *bitmap;
+    gc_handle raw, shape;
+
+    if(argc < 1 || argc > 2)
+        rt_error_arity(argc);
+    n = rt_check_index(argv[0], FIXNUM_MAX / sizeof(gc_handle));
+    bitmap = malloc((n / 32 + 1) * sizeof(uint32_t));
+    assert(bitmap);
+    memset(bitmap, 0xff, (n / 32 + 1) * sizeof(uint32_t));
+    for(raw = argc > 1 ? argv[1] : NIL; sc_consp(raw); raw = sc_cdr(raw)) {
+        if(!sc_numberp(sc_car(raw)) || sc_number(sc_car(raw)) < 0 || sc_number(sc_car(raw)) >= n) {
+            free(bitmap);
+            rt_error("Index out of range");
+        }
+        i = sc_number(sc_car(raw));
+        bitmap[i / 32] &= ~(1u << i % 32);
+    }
+    if(!NILP(raw)) {
+        free(bitmap);
+        rt_error("Not a list");
+    }
+    shape = sc_make_shape(n, bitmap);
+    free(bitmap);
+    return shape;
+}
+
+static gc_handle prim_make_record(gc_handle *argv, uint32_t argc) {
+    gc_handle r;
+    uint32_t i;
+
+    if(argc < 1 || !sc_shapep(argv[0]))
+        rt_error("Not a record type");
+    if(argc - 1 != sc_shape_len(argv[0]))
+        rt_error_arity(argc);
+    for(i = 0; i < argc - 1; i++) {
+        if(!sc_shape_pointer_field(argv[0], i))
+            rt_check_number(argv[i + 1]);
+    }
+    r = sc_alloc_record(argv[0]);
+    for(i = 0; i < argc - 1; i++) {
+        if(sc_shape_pointer_field(argv[0], i))
+            sc_record_set(r, i, argv[i + 1]);
+        else
+            sc_record_raw_set(r, i, sc_number(argv[i + 1]));
+    }
+    return r;
+}
+
+static gc_handle prim_recordp(gc_handle *argv, uint32_t argc) {
+    rt_check_argc(argc, 1);
+    return rt_boolean(sc_recordp(argv[0]));
+}
+
+static gc_handle prim_record_type(gc_handle *argv, uint32_t argc) {
+    rt_check_argc(argc, 1);
+    if(!sc_recordp(argv[0]))
+        rt_error("Not a record");
+    return sc_record_shape(argv[0]);
+}
+
+/* (record-ref type r i) */
+static gc_handle prim_record_ref(gc_handle *argv, uint32_t argc) {
+    gc_handle r;
+    uint32_t i;
+    int32_t x;
+
+    rt_check_argc(argc, 3);
+    r = rt_check_record(argv[0], argv[1]);
+    if(sc_shape_len(argv[0]) == 0)
+        rt_error("Index out of range");
+    i = rt_check_index(argv[2], sc_shape_len(argv[0]) - 1);
+    if(sc_shape_pointer_field(argv[0], i))
+        return sc_record_ref(r, i);
+    x = sc_record_raw_ref(r, i);
+    if(x < FIXNUM_MIN || x > FIXNUM_MAX)
+        rt_error("Field too big for a fixnum");
+    return sc_make_number(x);
+}
+
+/* (record-set! type r i x) */
+static gc_handle prim_record_set(gc_handle *argv, uint32_t argc) {
+    gc_handle r;
+    uint32_t i;
+
+    rt_check_argc(argc, 4);
+    r = rt_check_record(argv[0], argv[1]);
+    if(sc_shape_len(argv[0]) == 0)
+        rt_error("Index out of range");
+    i = rt_check_index(argv[2], sc_shape_len(argv[0]) - 1);
+    if(sc_shape_pointer_field(argv[0], i))
+        sc_record_set(r, i, argv[3]);
+    else
+        sc_record_raw_set(r, i, rt_check_number(argv[3]));
+    return argv[3];
+}
+
+void *rt_primitive_code;
+
+static struct {
+    char            *name;
+    sc_primitive_fn *fn;
+} rt_primitives[] = {
+    { "+",       prim_add },
+    { "-",       prim_sub },
+    { "*",       prim_mul },
+    { "=",       prim_num_eq },
+    { "<",       prim_lt },
+    { ">",       prim_gt },
+    { "cons",    prim_cons },
+    { "car",     prim_car },
+    { "cdr",     prim_cdr },
+    { "null?",   prim_nullp },
+    { "pair?",   prim_pairp },
+    { "eq?",     prim_eqp },
+    { "not",     prim_not },
+    { "display", prim_display },
+    { "make-bytevector",   prim_make_bytevector },
+    { "bytevector?",       prim_bytevectorp },
+    { "bytevector-length", prim_bytevector_length },
+    { "bytevector-u8-ref", prim_bytevector_ref },
+    { "bytevector-u8-set!", prim_bytevector_set },
+    { "bytevector-fill!",  prim_bytevector_fill },
+    { "bytevector-copy!",  prim_bytevector_copy },
+    { "make-s64vector",    prim_make_s64vector },
+    { "s64vector?",        prim_s64vectorp },
+    { "s64vector-length",  prim_s64vector_length },
+    { "s64vector-ref",     prim_s64vector_ref },
+    { "s64vector-set!",    prim_s64vector_set },
+    { "s64vector-fill!",   prim_s64vector_fill },
+    { "s64vector-copy!",   prim_s64vector_copy },
+    { "make-f64vector",    prim_make_f64vector },
+    { "f64vector?",        prim_f64vectorp },
+    { "f64vector-length",  prim_f64vector_length },
+    { "f64vector-set!",    prim_f64vector_set },
+    { "f64vector-fill!",   prim_f64vector_fill },
+    { "f64vector-copy!",   prim_f64vector_copy },
+    { "make-record-type",  prim_make_record_type },
+    { "make-record",       prim_make_record },
+    { "record?",           prim_recordp },
+    { "record-type",       prim_record_type },
+    { "record-ref",        prim_record_ref },
+    { "record-set!",       prim_record_set },
+};
+
+#define RT_NPRIMITIVES (sizeof(rt_primitives)/sizeof(rt_primitives[0]))
+
+sc_primitive_fn *rt_find_primitive(const char *name) {
+    uint32_t i;
+
+    for(i = 0; i < RT_NPRIMITIVES; i++) {
+        if(!strcmp(name, rt_primitives[i].name))
+            return rt_primitives[i].fn;
+    }
+    return NULL;
+}
+
+const char *rt_primitive_name(sc_primitive_fn *fn) {
+    uint32_t i;
+
+    for(i = 0; i < RT_NPRIMITIVES; i++) {
+        if(rt_primitives[i].fn == fn)
+            return rt_primitives[i].name;
+    }
+    return NULL;
+}
+
+/* Statistics */
+
+/*
+ * Timings on stderr for a run that began at start, if FLNV_STATS is
+ * set in the environment
+ */
+void rt_report_stats(struct timeval *start) {
+    struct timeval end;
+    struct rusage usage;
+
+    if(!getenv("FLNV_STATS"))
+        return;
+    fflush(stdout);
+    gettimeofday(&end, NULL);
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(stderr, "%.3fs elapsed, %ldKB max resident\n",
+            (end.tv_sec - start->tv_sec) + (end.tv_usec - start->tv_usec) / 1e6,
+            usage.ru_maxrss);
+}
+
+/* Printing */
+
+/* The writer bypasses stdio, so flush anything stdio still holds first */
+void rt_display(gc_handle v) {
+    fflush(stdout);
+    sc_write(STDOUT_FILENO, v, SC_WRITE_DISPLAY);
+}
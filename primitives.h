@@ -0,0 +1,31 @@
+#ifndef __FLNV_PRIMITIVES_H__
+#define __FLNV_PRIMITIVES_H__
+
+#include "scgc.h"
+
+#include <sys/time.h>
+
+/*
+ * The primitive procedures, and the error reporting they share with
+ * both execution backends: the native runtime (runtime.c) and the
+ * bytecode VM (vm.c).
+ */
+
+/* The primitive bound to a global name, or NULL if there isn't one */
+sc_primitive_fn *rt_find_primitive(const char *name);
+
+/* The name a primitive is bound to, or NULL if it isn't one of ours */
+const char *rt_primitive_name(sc_primitive_fn *fn);
+
+/*
+ * The code that compiled code calls to apply a primitive object, set by
+ * the backend: the native runtime's trampoline, or NULL on the VM.
+ */
+extern void *rt_primitive_code;
+
+void rt_error(const char *fmt, ...) __attribute__((noreturn));
+void rt_error_arity(uint32_t argc);
+void rt_display(gc_handle v);
+void rt_report_stats(struct timeval *start);
+
+#endif
@@ -0,0 +1,369 @@
+#include "reader.h"
+#include "scgc.h"
+#include "symbol.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define READER_STACK_INITIAL    64
+#define READER_FRAMES_INITIAL   16
+#define READER_NAME_INITIAL     64
+
+/*
+ * The reader doesn't recurse. Data it has read but not yet put into
+ * a list wait on a stack, which is a heap vector and the only thing
+ * it needs to keep rooted. Each open list or pending quote is a frame
+ * recording where its elements start on the stack. Closing one
+ * allocates all its pairs at once, so building a list of n elements
+ * costs one allocation instead of n.
+ */
+
+enum rd_frame_kind {
+    RD_LIST,
+    RD_QUOTE
+};
+
+typedef struct rd_frame {
+    enum rd_frame_kind kind;
+    uint32_t start;
+    int32_t  dot;               /* stack index of the datum after a ., or -1 */
+} rd_frame;
+
+typedef struct reader {
+    const char    *p, *end;
+    const char    *line_start;
+    uint32_t      line;
+    gc_handle     stack;
+    uint32_t      depth;
+    gc_handle     quote;
+    rd_frame      *frames;
+    uint32_t      nframes, frames_size;
+    char          *name;        /* a symbol's name, NUL-terminated */
+    size_t        name_size;
+    sc_read_error *err;
+} reader;
+
+static int rd_error(reader *r, const char *msg) {
+    if(r->err) {
+        r->err->line   = r->line;
+        r->err->column = r->p - r->line_start + 1;
+        r->err->msg    = msg;
+    }
+    return -1;
+}
+
+static inline int rd_delimiter(char c) {
+    return isspace((unsigned char)c) || c == '(' || c == ')'
+        || c == '\'' || c == '"' || c == ';';
+}
+
+/* As symbolStart and symbolChar in FLNV.Reader */
+static inline int rd_symbol_start(char c) {
+    return isalpha((unsigned char)c) || (c && strchr("*!$?<>=/+:_{}#-", c));
+}
+
+static inline int rd_symbol_char(char c) {
+    return rd_symbol_start(c) || isdigit((unsigned char)c) || c == '.';
+}
+
+static void rd_skip_space(reader *r) {
+    const char *nl;
+    while(r->p < r->end) {
+        if(*r->p == '\n') {
+            r->line++;
+            r->line_start = ++r->p;
+        } else if(isspace((unsigned char)*r->p)) {
+            r->p++;
+        } else if(*r->p == ';') {
+            nl = memchr(r->p, '\n', r->end - r->p);
+            r->p = nl ? nl : r->end;
+        } else {
+            break;
+        }
+    }
+}
+
+/* The stack */
+
+/* Make room for one more datum. Call it before making the datum. */
+static void rd_reserve(reader *r) {
+    uint32_t len = sc_vector_len(r->stack), i;
+    gc_handle bigger;
+
+    if(r->depth < len)
+        return;
+    bigger = sc_alloc_vector(len << 1);
+    for(i = 0; i < r->depth; i++)
+        sc_vector_set(bigger, i, sc_vector_ref(r->stack, i));
+    r->stack = bigger;
+}
+
+static inline void rd_push(reader *r, gc_handle v) {
+    sc_vector_set(r->stack, r->depth++, v);
+}
+
+/*
+ * Replace the n data from start on the stack with a list of them,
+ * ending with the datum after them if the list is dotted.
+ */
+static void rd_make_list(reader *r, uint32_t start, uint32_t n, int dotted) {
+    gc_handle list, c;
+    uint32_t i;
+
+    rd_reserve(r);
+    list = sc_alloc_list(n);
+    for(i = 0, c = list; i < n; i++, c = sc_cdr(c)) {
+        sc_set_car(c, sc_vector_ref(r->stack, start + i));
+        if(dotted && i == n - 1)
+            sc_set_cdr(c, sc_vector_ref(r->stack, start + n));
+    }
+    r->depth = start;
+    rd_push(r, list);
+}
+
+/* Frames */
+
+static void rd_open(reader *r, enum rd_frame_kind kind) {
+    rd_frame *f;
+
+    if(r->nframes == r->frames_size) {
+        r->frames_size <<= 1;
+        r->frames = realloc(r->frames, r->frames_size * sizeof(rd_frame));
+        assert(r->frames);
+    }
+    f = &r->frames[r->nframes++];
+    f->kind  = kind;
+    f->start = r->depth;
+    f->dot   = -1;
+}
+
+static inline rd_frame *rd_top(reader *r) {
+    return r->nframes ? &r->frames[r->nframes - 1] : NULL;
+}
+
+/* A datum has just been pushed: wrap it in any quotes waiting for it */
+static void rd_close_quotes(reader *r) {
+    gc_handle q;
+    rd_frame *f;
+
+    while((f = rd_top(r)) && f->kind == RD_QUOTE) {
+        q = sc_alloc_list(2);
+        sc_set_car(q, r->quote);
+        sc_set_car(sc_cdr(q), sc_vector_ref(r->stack, r->depth - 1));
+        sc_vector_set(r->stack, r->depth - 1, q);
+        r->nframes--;
+    }
+}
+
+/* Atoms */
+
+static int rd_token(reader *r, const char *tok, size_t len, gc_handle *v) {
+    const char *q = tok;
+    int negative = 0;
+    gc_int n = 0;
+
+    if(len > 1 && (*q == '-' || *q == '+')) {
+        negative = *q++ == '-';
+    }
+    if(q < tok + len && isdigit((unsigned char)*q)) {
+        for(; q < tok + len && isdigit((unsigned char)*q); q++) {
+            if(n <= FIXNUM_MAX)
+                n = n * 10 + (*q - '0');
+        }
+        if(q == tok + len) {
+            n = negative ? -n : n;
+            if(n < FIXNUM_MIN || n > FIXNUM_MAX) {
+                r->p = tok;
+                return rd_error(r, "number out of range");
+            }
+            *v = sc_make_number(n);
+            return 0;
+        }
+    }
+
+    if(len == 2 && tok[0] == '#' && (tok[1] == 't' || tok[1] == 'f')) {
+        *v = tok[1] == 't' ? sc_true : sc_false;
+        return 0;
+    }
+
+    for(q = tok; q < tok + len && rd_symbol_char(*q); q++)
+        ;
+    if(!rd_symbol_start(*tok) || q < tok + len) {
+        r->p = tok;
+        return rd_error(r, "not a symbol or number");
+    }
+
+    if(len + 1 > r->name_size) {
+        while(len + 1 > r->name_size)
+            r->name_size <<= 1;
+        r->name = realloc(r->name, r->name_size);
+        assert(r->name);
+    }
+    memcpy(r->name, tok, len);
+    r->name[len] = '\0';
+    *v = sc_intern_symbol(r->name);
+    return 0;
+}
+
+static int rd_atom(reader *r, gc_handle *v) {
+    const char *start = r->p, *line_start = r->line_start, *q;
+    uint32_t line = r->line;
+    size_t len;
+
+    if(*start == '"') {
+        for(q = start + 1; q < r->end && *q != '"'; q++) {
+            if(*q == '\n') {
+                r->line++;
+                r->line_start = q + 1;
+            }
+        }
+        if(q == r->end) {
+            /* Point at the opening quote */
+            r->line = line;
+            r->line_start = line_start;
+            return rd_error(r, "unterminated string literal");
+        }
+        len = q - start - 1;
+        *v = sc_alloc_string(len + 1);
+        memcpy(sc_string_get(*v), start + 1, len);
+        sc_string_get(*v)[len] = '\0';
+        r->p = q + 1;
+        return 0;
+    }
+
+    for(q = start; q < r->end && !rd_delimiter(*q); q++)
+        ;
+    r->p = q;
+    return rd_token(r, start, q - start, v);
+}
+
+/* The reader proper */
+
+static int rd_forms(reader *r) {
+    rd_frame *f;
+    gc_handle v;
+
+    for(;;) {
+        rd_skip_space(r);
+        if(r->p == r->end)
+            return r->nframes ? rd_error(r, "unexpected end of input") : 0;
+
+        f = rd_top(r);
+        if(*r->p == ')') {
+            if(!f || f->kind != RD_LIST)
+                return rd_error(r, "unexpected )");
+            if(f->dot >= 0 && r->depth == f->dot)
+                return rd_error(r, "expected a datum after .");
+            r->p++;
+            if(f->dot >= 0)
+                rd_make_list(r, f->start, f->dot - f->start, 1);
+            else
+                rd_make_list(r, f->start, r->depth - f->start, 0);
+            r->nframes--;
+            rd_close_quotes(r);
+            continue;
+        }
+
+        if(f && f->kind == RD_LIST && f->dot >= 0 && r->depth > f->dot)
+            return rd_error(r, "expected ) after dotted tail");
+
+        switch(*r->p) {
+        case '(':
+            r->p++;
+            rd_open(r, RD_LIST);
+            continue;
+        case '\'':
+            r->p++;
+            rd_open(r, RD_QUOTE);
+            continue;
+        case '.':
+            if(r->p + 1 < r->end && !rd_delimiter(r->p[1]))
+                break;
+            if(!f || f->kind != RD_LIST || f->dot >= 0 || r->depth == f->start)
+                return rd_error(r, "unexpected .");
+            r->p++;
+            f->dot = r->depth;
+            continue;
+        }
+
+        rd_reserve(r);
+        if(rd_atom(r, &v))
+            return -1;
+        rd_push(r, v);
+        rd_close_quotes(r);
+    }
+}
+
+int sc_read_buffer(const char *buf, size_t len, gc_handle *forms, sc_read_error *err) {
+    reader r;
+    int status;
+
+    r.p = r.line_start = buf;
+    r.end = buf + len;
+    r.line = 1;
+    r.depth = 0;
+    r.nframes = 0;
+    r.frames_size = READER_FRAMES_INITIAL;
+    r.frames = malloc(r.frames_size * sizeof(rd_frame));
+    r.name_size = READER_NAME_INITIAL;
+    r.name = malloc(r.name_size);
+    r.err = err;
+    assert(r.frames && r.name);
+
+    r.stack = r.quote = NIL;
+    gc_register_roots(&r.stack, &r.quote, NULL);
+    r.stack = sc_alloc_vector(READER_STACK_INITIAL);
+    r.quote = sc_intern_symbol("quote");
+
+    status = rd_forms(&r);
+    if(!status) {
+        rd_make_list(&r, 0, r.depth, 0);
+        *forms = sc_vector_ref(r.stack, 0);
+    }
+
+    gc_pop_roots();
+    free(r.frames);
+    free(r.name);
+    return status;
+}
+
+static int rd_file_error(sc_read_error *err) {
+    if(err) {
+        err->line = err->column = 0;
+        err->msg = strerror(errno);
+    }
+    return -1;
+}
+
+int sc_read_file(const char *path, gc_handle *forms, sc_read_error *err) {
+    struct stat st;
+    void *buf;
+    int fd, status;
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return rd_file_error(err);
+    if(fstat(fd, &st) < 0) {
+        close(fd);
+        return rd_file_error(err);
+    }
+    if(st.st_size == 0) {
+        close(fd);
+        return sc_read_buffer("", 0, forms, err);
+    }
+
+    buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(buf == MAP_FAILED)
+        return rd_file_error(err);
+    madvise(buf, st.st_size, MADV_SEQUENTIAL);
+
+    status = sc_read_buffer(buf, st.st_size, forms, err);
+    munmap(buf, st.st_size);
+    return status;
+}
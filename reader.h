@@ -0,0 +1,31 @@
+#ifndef __FLNV_READER_H__
+#define __FLNV_READER_H__
+
+#include <stddef.h>
+
+#include "gc.h"
+
+/*
+ * A reader for S-expression data, which builds heap objects directly.
+ * It accepts the same syntax as the compiler's reader -- lists, dotted
+ * pairs, quote, strings without escapes, #t and #f, symbols, fixnums
+ * and ; comments -- except that numbers may have a sign. Like that
+ * reader, it rejects tokens such as 1abc that are neither.
+ */
+
+typedef struct sc_read_error {
+    uint32_t   line;            /* 0 if the file couldn't be read */
+    uint32_t   column;
+    const char *msg;
+} sc_read_error;
+
+/*
+ * Read every top-level datum in buf, and store the list of them in
+ * *forms. Returns 0 on success, or -1 after filling in *err.
+ */
+int sc_read_buffer(const char *buf, size_t len, gc_handle *forms, sc_read_error *err);
+
+/* The same, for a file, which is mapped rather than read */
+int sc_read_file(const char *path, gc_handle *forms, sc_read_error *err);
+
+#endif
@@ -0,0 +1,170 @@
+#include "runtime.h"
+#include "scgc.h"
+#include "symbol.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+gc_handle rt_env;
+gc_handle rt_proc;
+gc_handle *rt_sp;
+
+static gc_handle *rt_stack;
+
+uintptr_t *rt_region_ptr;
+uintptr_t *rt_region_limit;
+static uintptr_t *rt_region;
+
+/* Provided by the compiler's output */
+extern gc_handle flnv_entry(void);
+extern char flnv_apply_primitive[];
+extern const rt_constant flnv_constant_table[];
+extern const uint32_t flnv_nconstants;
+extern gc_handle flnv_constants[];
+extern const char * const flnv_global_names[];
+extern const uint32_t flnv_nglobals;
+extern gc_handle flnv_globals[];
+
+/* Errors */
+
+void rt_error_not_procedure(gc_handle val UNUSED) {
+    rt_error("Attempt to apply a non-procedure");
+}
+
+void rt_error_unbound(uint32_t global) {
+    rt_error("Unbound variable: %s", flnv_global_names[global]);
+}
+
+/* Entry points for compiled code */
+
+void *rt_alloc_slow(uint32_t words) {
+    return gc_alloc(NULL, words);
+}
+
+/*
+ * Arguments are passed on the stack; primitives see them in place and
+ * they are popped once the primitive returns.
+ */
+gc_handle rt_apply_primitive(uint32_t argc) {
+    gc_handle val;
+    assert(sc_primitivep(rt_proc));
+    val = sc_primitive_get(rt_proc)(rt_sp - argc, argc);
+    rt_sp -= argc;
+    return val;
+}
+
+/* Initialization */
+
+static void rt_relocate_roots(void) {
+    gc_handle *p;
+    uintptr_t *obj;
+    uint32_t i;
+
+    for(p = rt_stack; p < rt_sp; p++)
+        gc_relocate(p);
+    for(obj = rt_region; obj < rt_region_ptr; obj += gc_object_len((gc_chunk*)obj))
+        gc_relocate_object((gc_chunk*)obj);
+    for(i = 0; i < flnv_nconstants; i++)
+        gc_relocate(&flnv_constants[i]);
+    for(i = 0; i < flnv_nglobals; i++)
+        gc_relocate(&flnv_globals[i]);
+}
+
+static void rt_load_constants(void) {
+    const rt_constant *c;
+    gc_handle v;
+    uint32_t i;
+
+    for(i = 0; i < flnv_nconstants; i++) {
+        c = &flnv_constant_table[i];
+        switch(c->kind) {
+        case RT_CONST_IMMEDIATE:
+            v = c->car;
+            break;
+        case RT_CONST_BOOLEAN:
+            v = c->car ? sc_true : sc_false;
+            break;
+        case RT_CONST_SYMBOL:
+            v = sc_intern_static_symbol(c->car);
+            assert(v == c->car);
+            break;
+        case RT_CONST_CONS:
+            v = sc_alloc_cons();
+            sc_set_car(v, flnv_constants[c->car]);
+            sc_set_cdr(v, flnv_constants[c->cdr]);
+            break;
+        default:
+            rt_error("Bad constant descriptor %d", c->kind);
+        }
+        flnv_constants[i] = v;
+    }
+}
+
+/*
+ * Global cells start out as 0, which is neither a number nor a
+ * pointer; compiled code treats that as unbound.
+ */
+static void rt_init_globals(void) {
+    sc_primitive_fn *fn;
+    gc_handle prim;
+    uint32_t i;
+
+    for(i = 0; i < flnv_nglobals; i++) {
+        if((fn = rt_find_primitive(flnv_global_names[i]))) {
+            prim = sc_alloc_primitive(rt_primitive_code, fn);
+            flnv_globals[i] = prim;
+        }
+    }
+}
+
+/*
+ * The stack is followed by an inaccessible guard page, so that
+ * running off the end faults instead of scribbling over the heap.
+ */
+static gc_handle *rt_alloc_stack(void) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = ROUNDUP(RT_STACK_SIZE * sizeof(gc_handle), page);
+    char *stack = mmap(NULL, size + page, PROT_READ|PROT_WRITE,
+                       MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    assert(stack != MAP_FAILED);
+    mprotect(stack + size, page, PROT_NONE);
+    return (gc_handle*)stack;
+}
+
+void rt_init() {
+    rt_stack = rt_alloc_stack();
+    rt_sp = rt_stack;
+
+    rt_region = rt_region_ptr = gc_alloc_region(RT_REGION_WORDS);
+    rt_region_limit = rt_region + RT_REGION_WORDS;
+
+    rt_env = rt_proc = NIL;
+    gc_register_roots(&rt_env, &rt_proc, NULL);
+    gc_register_gc_root_hook(rt_relocate_roots);
+
+    rt_primitive_code = flnv_apply_primitive;
+    rt_load_constants();
+    rt_init_globals();
+}
+
+int main() {
+    struct timeval start;
+    gc_handle val;
+
+    gettimeofday(&start, NULL);
+
+    gc_init();
+    sc_init();
+    obarray_init();
+    rt_init();
+
+    val = flnv_entry();
+    rt_display(val);
+    putchar('\n');
+
+    rt_report_stats(&start);
+    return 0;
+}
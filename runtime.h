@@ -0,0 +1,62 @@
+#ifndef __FLNV_RUNTIME_H__
+#define __FLNV_RUNTIME_H__
+
+#include "gc.h"
+#include "primitives.h"
+
+/*
+ * Support for code produced by the native compiler (FLNV.Compile).
+ *
+ * Compiled code keeps the SICP machine registers in callee-saved
+ * machine registers, and spills them to rt_env/rt_proc/rt_sp around
+ * every call into C so that the collector can find and relocate
+ * them.
+ */
+
+#define RT_STACK_SIZE   (1 << 20)
+#define RT_REGION_WORDS (1 << 20)
+
+extern gc_handle rt_env;
+extern gc_handle rt_proc;
+extern gc_handle *rt_sp;
+
+/*
+ * Objects that the compiler has proven can't outlive the procedure
+ * call that creates them are bump-allocated here instead of in the
+ * heap, and freed by resetting rt_region_ptr when the call returns.
+ * They are objects outside the heap in the sense of gc.h: never
+ * moved, but scanned on every collection.
+ */
+extern uintptr_t *rt_region_ptr;
+extern uintptr_t *rt_region_limit;
+
+/*
+ * Constant descriptors, emitted by the compiler into .rodata. Most
+ * constants are static objects in the executable (see gc.h), whose
+ * handles are known at link time; they are IMMEDIATE, except that
+ * SYMBOLs still have to be added to the obarray. Booleans, and pairs
+ * that contain them, are allocated at startup.
+ */
+enum rt_constant_kind {
+    RT_CONST_IMMEDIATE,
+    RT_CONST_BOOLEAN,
+    RT_CONST_SYMBOL,
+    RT_CONST_CONS
+};
+
+typedef struct rt_constant {
+    uint32_t   kind;
+    uint32_t   car;
+    uint32_t   cdr;
+} rt_constant;
+
+void rt_init();
+
+/* Entry points called from compiled code */
+void *rt_alloc_slow(uint32_t words);
+gc_handle rt_apply_primitive(uint32_t argc);
+void rt_error_not_procedure(gc_handle val);
+void rt_error_arity(uint32_t argc);
+void rt_error_unbound(uint32_t global);
+
+#endif
@@ -1,11 +1,27 @@
 #include <string.h>
+#include <stddef.h>
 
 #include "scgc.h"
 
-#define STRLEN2CELLS(x) (ROUNDUP(((uint32_t)(x)),sizeof(gc_handle))/sizeof(gc_handle))
+#define STRING_WORDS(len)  GC_WORDS(offsetof(sc_string, string) + (len))
+#define VECTOR_WORDS(len)  GC_WORDS(offsetof(sc_vector, vector) + (len) * sizeof(gc_handle))
+#define CLOSURE_WORDS(len) GC_WORDS(offsetof(sc_closure, free) + (len) * sizeof(gc_handle))
+#define SHAPE_WORDS(len)   GC_WORDS(offsetof(sc_shape, bitmap) + BITMAP_LEN(len) * sizeof(uint32_t))
+#define RECORD_WORDS(len)  GC_WORDS(offsetof(sc_record, fields) + (len) * sizeof(gc_handle))
+#define BITMAP_LEN(len)    ((len) / 32 + 1)
+#define RAW_VECTOR_WORDS(len, size) GC_WORDS(offsetof(sc_raw_vector, data) + (size_t)(len) * (size))
+
+/* Shapes are carved out of regions this size */
+#define SHAPE_REGION_WORDS 1024u
 
 gc_handle sc_true, sc_false;
 
+static uintptr_t *sc_shape_region, *sc_shape_region_limit;
+
+/* Shapes in use, and those free to reuse */
+static sc_shape *sc_shapes, *sc_free_shapes;
+static uint32_t sc_epoch;
+
 /* Types */
 typedef struct sc_cons {
     gc_chunk header;
@@ -27,27 +43,85 @@ typedef struct sc_vector {
     gc_handle vector[];
 } sc_vector;
 
+/*
+ * Bytevectors, s64vectors and f64vectors share a layout: a length in
+ * elements, then the elements themselves, which the collector copies
+ * but never scans. The data starts on an 8-byte boundary (on 64-bit
+ * hosts, where heap words are 8 bytes), so loops over it vectorize.
+ */
+typedef struct sc_raw_vector {
+    gc_chunk header;
+    uint32_t len;
+    uint64_t data[];
+} sc_raw_vector;
+
 typedef struct sc_boolean {
     gc_chunk header;
     int      val;
 } sc_boolean;
 
+/* A flat closure: code plus the values of its free variables */
+typedef struct sc_closure {
+    gc_chunk  header;
+    void      *code;
+    uint32_t  nfree;
+    gc_handle free[];
+} sc_closure;
+
+typedef struct sc_primitive {
+    gc_chunk        header;
+    void            *code;
+    sc_primitive_fn *fn;
+} sc_primitive;
+
 /* Op functions */
 
 uint32_t sc_len_string(gc_chunk *v) {
-    return sizeof(sc_string)/sizeof(gc_handle) + STRLEN2CELLS(((sc_string*)v)->strlen);
+    return STRING_WORDS(((sc_string*)v)->strlen);
 }
 
 uint32_t sc_len_cons(gc_chunk *v UNUSED) {
-    return sizeof(sc_cons)/sizeof(gc_handle);
+    return GC_WORDS(sizeof(sc_cons));
 }
 
 uint32_t sc_len_vector(gc_chunk *v) {
-    return sizeof(sc_vector)/sizeof(gc_handle) + ((sc_vector*)v)->veclen;
+    return VECTOR_WORDS(((sc_vector*)v)->veclen);
+}
+
+uint32_t sc_len_bytevector(gc_chunk *v) {
+    return RAW_VECTOR_WORDS(((sc_raw_vector*)v)->len, sizeof(uint8_t));
+}
+
+uint32_t sc_len_s64vector(gc_chunk *v) {
+    return RAW_VECTOR_WORDS(((sc_raw_vector*)v)->len, sizeof(int64_t));
+}
+
+uint32_t sc_len_f64vector(gc_chunk *v) {
+    return RAW_VECTOR_WORDS(((sc_raw_vector*)v)->len, sizeof(double));
 }
 
 uint32_t sc_len_boolean(gc_chunk *v UNUSED) {
-    return sizeof(sc_boolean)/sizeof(gc_handle);
+    return GC_WORDS(sizeof(sc_boolean));
+}
+
+uint32_t sc_len_closure(gc_chunk *v) {
+    return CLOSURE_WORDS(((sc_closure*)v)->nfree);
+}
+
+uint32_t sc_len_primitive(gc_chunk *v UNUSED) {
+    return GC_WORDS(sizeof(sc_primitive));
+}
+
+uint32_t sc_len_shape(gc_chunk *v) {
+    return SHAPE_WORDS(((sc_shape*)v)->nfields);
+}
+
+static inline sc_shape *sc_shape_of(gc_chunk *record) {
+    return (sc_shape*)((char*)record->ops - offsetof(sc_shape, ops));
+}
+
+uint32_t sc_len_record(gc_chunk *v) {
+    return RECORD_WORDS(sc_shape_of(v)->nfields);
 }
 
 void sc_relocate_cons(gc_chunk *v) {
@@ -65,32 +139,90 @@ void sc_relocate_vector(gc_chunk *v) {
     }
 }
 
+void sc_relocate_closure(gc_chunk *v) {
+    uint32_t i;
+    sc_closure *clo = (sc_closure*)v;
+
+    for(i = 0; i < clo->nfree; i++) {
+        gc_relocate(&clo->free[i]);
+    }
+}
+
+/* Only the pointer fields, a bitmap word at a time */
+void sc_relocate_record(gc_chunk *v) {
+    sc_record *rec = (sc_record*)v;
+    sc_shape *shape = sc_shape_of(v);
+    uint32_t i, bits;
+
+    shape->epoch = sc_epoch;
+    for(i = 0; i < BITMAP_LEN(shape->nfields); i++) {
+        for(bits = shape->bitmap[i]; bits; bits &= bits - 1)
+            gc_relocate(&rec->fields[i * 32 + __builtin_ctz(bits)]);
+    }
+}
+
+/* Shapes are in use while there are handles to them or records of them */
+static void sc_mark_shape(gc_chunk *v) {
+    ((sc_shape*)v)->epoch = sc_epoch;
+}
+
 /* Op structs */
-static struct gc_ops sc_symbol_ops = {
+struct gc_ops sc_symbol_ops = {
     .op_relocate = gc_relocate_nop,
     .op_len      = sc_len_string
 };
 
-static struct gc_ops sc_string_ops = {
+struct gc_ops sc_string_ops = {
     .op_relocate = gc_relocate_nop,
     .op_len      = sc_len_string
 };
 
-static struct gc_ops sc_cons_ops = {
+struct gc_ops sc_cons_ops = {
     .op_relocate = sc_relocate_cons,
     .op_len      = sc_len_cons
 };
 
-static struct gc_ops sc_vector_ops = {
+struct gc_ops sc_vector_ops = {
     .op_relocate = sc_relocate_vector,
     .op_len      = sc_len_vector
 };
 
-static struct gc_ops sc_boolean_ops = {
+struct gc_ops sc_bytevector_ops = {
+    .op_relocate = gc_relocate_nop,
+    .op_len      = sc_len_bytevector
+};
+
+struct gc_ops sc_s64vector_ops = {
+    .op_relocate = gc_relocate_nop,
+    .op_len      = sc_len_s64vector
+};
+
+struct gc_ops sc_f64vector_ops = {
+    .op_relocate = gc_relocate_nop,
+    .op_len      = sc_len_f64vector
+};
+
+struct gc_ops sc_boolean_ops = {
     .op_relocate = gc_relocate_nop,
     .op_len      = sc_len_boolean
 };
 
+struct gc_ops sc_closure_ops = {
+    .op_relocate = sc_relocate_closure,
+    .op_len      = sc_len_closure
+};
+
+struct gc_ops sc_primitive_ops = {
+    .op_relocate = gc_relocate_nop,
+    .op_len      = sc_len_primitive
+};
+
+struct gc_ops sc_shape_ops = {
+    .op_relocate = gc_relocate_nop,
+    .op_len      = sc_len_shape,
+    .op_mark     = sc_mark_shape
+};
+
 /* Public API */
 
 gc_handle sc_car(gc_handle c) {
@@ -154,6 +286,142 @@ void sc_vector_set(gc_handle v, uint32_t n, gc_handle x) {
     UNTAG_PTR(v, sc_vector)->vector[n] = x;
 }
 
+uint32_t sc_bytevector_len(gc_handle v) {
+    assert(sc_bytevectorp(v));
+    return UNTAG_PTR(v, sc_raw_vector)->len;
+}
+
+uint8_t *sc_bytevector_data(gc_handle v) {
+    assert(sc_bytevectorp(v));
+    return (uint8_t*)UNTAG_PTR(v, sc_raw_vector)->data;
+}
+
+uint32_t sc_s64vector_len(gc_handle v) {
+    assert(sc_s64vectorp(v));
+    return UNTAG_PTR(v, sc_raw_vector)->len;
+}
+
+int64_t *sc_s64vector_data(gc_handle v) {
+    assert(sc_s64vectorp(v));
+    return (int64_t*)UNTAG_PTR(v, sc_raw_vector)->data;
+}
+
+uint32_t sc_f64vector_len(gc_handle v) {
+    assert(sc_f64vectorp(v));
+    return UNTAG_PTR(v, sc_raw_vector)->len;
+}
+
+double *sc_f64vector_data(gc_handle v) {
+    assert(sc_f64vectorp(v));
+    return (double*)UNTAG_PTR(v, sc_raw_vector)->data;
+}
+
+/* Bulk operations, as plain loops over the data that the compiler vectorizes */
+
+void sc_bytevector_fill(gc_handle v, uint8_t x, uint32_t start, uint32_t end) {
+    assert(start <= end && end <= sc_bytevector_len(v));
+    memset(sc_bytevector_data(v) + start, x, end - start);
+}
+
+void sc_s64vector_fill(gc_handle v, int64_t x, uint32_t start, uint32_t end) {
+    int64_t *data = sc_s64vector_data(v);
+    uint32_t i;
+
+    assert(start <= end && end <= sc_s64vector_len(v));
+    for(i = start; i < end; i++)
+        data[i] = x;
+}
+
+void sc_f64vector_fill(gc_handle v, double x, uint32_t start, uint32_t end) {
+    double *data = sc_f64vector_data(v);
+    uint32_t i;
+
+    assert(start <= end && end <= sc_f64vector_len(v));
+    for(i = start; i < end; i++)
+        data[i] = x;
+}
+
+/*
+ * Copy elements [start, end) of from into to at at. The two must be
+ * the same type, and may be the same vector.
+ */
+void sc_raw_vector_copy(gc_handle to, uint32_t at, gc_handle from, uint32_t start, uint32_t end) {
+    sc_raw_vector *dst = UNTAG_PTR(to, sc_raw_vector);
+    sc_raw_vector *src = UNTAG_PTR(from, sc_raw_vector);
+    size_t size = sc_bytevectorp(from) ? sizeof(uint8_t) : sizeof(uint64_t);
+
+    assert(sc_raw_vectorp(from) && dst->header.ops == src->header.ops);
+    assert(start <= end && end <= src->len && at <= dst->len && end - start <= dst->len - at);
+    memmove((char*)dst->data + at * size, (char*)src->data + start * size, (end - start) * size);
+}
+
+uint32_t sc_shape_len(gc_handle shape) {
+    assert(sc_shapep(shape));
+    return UNTAG_PTR(shape, sc_shape)->nfields;
+}
+
+int sc_shape_pointer_field(gc_handle shape, uint32_t n) {
+    assert(n < sc_shape_len(shape));
+    return UNTAG_PTR(shape, sc_shape)->bitmap[n / 32] >> (n % 32) & 1;
+}
+
+gc_handle sc_record_shape(gc_handle r) {
+    assert(sc_recordp(r));
+    return gc_tag_pointer(sc_shape_of(UNTAG_PTR(r, gc_chunk)));
+}
+
+gc_handle sc_record_ref(gc_handle r, uint32_t n) {
+    assert(sc_shape_pointer_field(sc_record_shape(r), n));
+    return UNTAG_PTR(r, sc_record)->fields[n];
+}
+
+void sc_record_set(gc_handle r, uint32_t n, gc_handle x) {
+    assert(sc_shape_pointer_field(sc_record_shape(r), n));
+    UNTAG_PTR(r, sc_record)->fields[n] = x;
+}
+
+int32_t sc_record_raw_ref(gc_handle r, uint32_t n) {
+    assert(!sc_shape_pointer_field(sc_record_shape(r), n));
+    return UNTAG_PTR(r, sc_record)->fields[n];
+}
+
+void sc_record_raw_set(gc_handle r, uint32_t n, int32_t x) {
+    assert(!sc_shape_pointer_field(sc_record_shape(r), n));
+    UNTAG_PTR(r, sc_record)->fields[n] = x;
+}
+
+uint32_t sc_closure_len(gc_handle c) {
+    assert(sc_closurep(c));
+    return UNTAG_PTR(c, sc_closure)->nfree;
+}
+
+gc_handle sc_closure_ref(gc_handle c, uint32_t n) {
+    assert(sc_closurep(c));
+    assert(n < sc_closure_len(c));
+    return UNTAG_PTR(c, sc_closure)->free[n];
+}
+
+void sc_closure_set(gc_handle c, uint32_t n, gc_handle x) {
+    assert(sc_closurep(c));
+    assert(n < sc_closure_len(c));
+    UNTAG_PTR(c, sc_closure)->free[n] = x;
+}
+
+void *sc_closure_code(gc_handle c) {
+    assert(sc_closurep(c));
+    return UNTAG_PTR(c, sc_closure)->code;
+}
+
+sc_primitive_fn *sc_primitive_get(gc_handle p) {
+    assert(sc_primitivep(p));
+    return UNTAG_PTR(p, sc_primitive)->fn;
+}
+
+void *sc_primitive_code(gc_handle p) {
+    assert(sc_primitivep(p));
+    return UNTAG_PTR(p, sc_primitive)->code;
+}
+
 /* Predicates */
 static inline int sc_pointer_typep(gc_handle c, gc_ops *type) {
     return gc_pointerp(c)
@@ -177,10 +445,44 @@ int sc_vectorp(gc_handle c) {
     return sc_pointer_typep(c, &sc_vector_ops);
 }
 
+int sc_bytevectorp(gc_handle c) {
+    return sc_pointer_typep(c, &sc_bytevector_ops);
+}
+
+int sc_s64vectorp(gc_handle c) {
+    return sc_pointer_typep(c, &sc_s64vector_ops);
+}
+
+int sc_f64vectorp(gc_handle c) {
+    return sc_pointer_typep(c, &sc_f64vector_ops);
+}
+
+int sc_raw_vectorp(gc_handle c) {
+    return sc_bytevectorp(c) || sc_s64vectorp(c) || sc_f64vectorp(c);
+}
+
 int sc_booleanp(gc_handle c) {
     return sc_pointer_typep(c, &sc_boolean_ops);
 }
 
+int sc_closurep(gc_handle c) {
+    return sc_pointer_typep(c, &sc_closure_ops);
+}
+
+int sc_primitivep(gc_handle c) {
+    return sc_pointer_typep(c, &sc_primitive_ops);
+}
+
+int sc_shapep(gc_handle c) {
+    return sc_pointer_typep(c, &sc_shape_ops);
+}
+
+int sc_recordp(gc_handle c) {
+    return gc_pointerp(c)
+        && !NILP(c)
+        && UNTAG_PTR(c, gc_chunk)->ops->op_relocate == sc_relocate_record;
+}
+
 int sc_numberp(gc_handle c) {
     return gc_numberp(c);
 }
@@ -188,19 +490,40 @@ int sc_numberp(gc_handle c) {
 /* Memory allocation */
 
 gc_handle sc_alloc_cons() {
-    sc_cons *cons = (sc_cons*)gc_alloc(&sc_cons_ops, 3);
+    sc_cons *cons = (sc_cons*)gc_alloc(&sc_cons_ops, GC_WORDS(sizeof(sc_cons)));
     cons->car = cons->cdr = NIL;
     return gc_tag_pointer(cons);
 }
 
+/*
+ * n fresh pairs, allocated as one batch and chained through their
+ * cdrs. The cars and the last cdr are nil.
+ */
+gc_handle sc_alloc_list(uint32_t n) {
+    uintptr_t *mem;
+    sc_cons *cons;
+    uint32_t i, words = GC_WORDS(sizeof(sc_cons));
+
+    if(n == 0)
+        return NIL;
+    mem = gc_alloc_batch(n * words);
+    for(i = 0; i < n; i++) {
+        cons = (sc_cons*)(mem + i * words);
+        cons->header.ops = &sc_cons_ops;
+        cons->car = NIL;
+        cons->cdr = i + 1 < n ? gc_tag_pointer(mem + (i + 1) * words) : NIL;
+    }
+    return gc_tag_pointer(mem);
+}
+
 gc_handle sc_alloc_string(uint32_t len) {
-    sc_string *str = (sc_string*)gc_alloc(&sc_string_ops, STRLEN2CELLS(len) + 2);
+    sc_string *str = (sc_string*)gc_alloc(&sc_string_ops, STRING_WORDS(len));
     str->strlen = len;
     return gc_tag_pointer(str);
 }
 
 gc_handle sc_alloc_vector(uint32_t len) {
-    sc_vector *vec = (sc_vector*)gc_alloc(&sc_vector_ops, len + 2);
+    sc_vector *vec = (sc_vector*)gc_alloc(&sc_vector_ops, VECTOR_WORDS(len));
     int i;
     vec->veclen = len;
     for(i = 0; i < len; i++) {
@@ -209,12 +532,161 @@ gc_handle sc_alloc_vector(uint32_t len) {
     return gc_tag_pointer(vec);
 }
 
+/* Raw vectors start out zeroed, which is 0.0 for an f64vector */
+static gc_handle sc_alloc_raw_vector(gc_ops *ops, uint32_t len, size_t size) {
+    uint32_t words = RAW_VECTOR_WORDS(len, size);
+    sc_raw_vector *vec = (sc_raw_vector*)gc_alloc(ops, words);
+    vec->len = len;
+    memset(vec->data, 0, words * sizeof(uintptr_t) - offsetof(sc_raw_vector, data));
+    return gc_tag_pointer(vec);
+}
+
+gc_handle sc_alloc_bytevector(uint32_t len) {
+    return sc_alloc_raw_vector(&sc_bytevector_ops, len, sizeof(uint8_t));
+}
+
+gc_handle sc_alloc_s64vector(uint32_t len) {
+    return sc_alloc_raw_vector(&sc_s64vector_ops, len, sizeof(int64_t));
+}
+
+gc_handle sc_alloc_f64vector(uint32_t len) {
+    return sc_alloc_raw_vector(&sc_f64vector_ops, len, sizeof(double));
+}
+
 gc_handle sc_alloc_symbol(uint32_t len) {
-    sc_symbol *sym = (sc_string*)gc_alloc(&sc_symbol_ops, STRLEN2CELLS(len) + 2);
+    sc_symbol *sym = (sc_string*)gc_alloc(&sc_symbol_ops, STRING_WORDS(len));
     sym->strlen = len;
     return gc_tag_pointer(sym);
 }
 
+gc_handle sc_alloc_closure(void *code, uint32_t nfree) {
+    sc_closure *clo = (sc_closure*)gc_alloc(&sc_closure_ops, CLOSURE_WORDS(nfree));
+    int i;
+    clo->code  = code;
+    clo->nfree = nfree;
+    for(i = 0; i < nfree; i++) {
+        clo->free[i] = NIL;
+    }
+    return gc_tag_pointer(clo);
+}
+
+gc_handle sc_alloc_primitive(void *code, sc_primitive_fn *fn) {
+    sc_primitive *prim = (sc_primitive*)gc_alloc(&sc_primitive_ops, GC_WORDS(sizeof(sc_primitive)));
+    prim->code = code;
+    prim->fn   = fn;
+    return gc_tag_pointer(prim);
+}
+
+/* Pointer fields start out nil, and raw ones zero */
+gc_handle sc_alloc_record(gc_handle shape) {
+    sc_shape *s = UNTAG_PTR(shape, sc_shape);
+
+    assert(sc_shapep(shape));
+    /* Keep the shape through this collection too, as for a new one */
+    s->epoch = sc_epoch;
+    return sc_place_record(gc_alloc(&s->ops, RECORD_WORDS(s->nfields)), shape);
+}
+
+/* Laying out objects by hand */
+
+uint32_t sc_cons_words(void) {
+    return GC_WORDS(sizeof(sc_cons));
+}
+
+uint32_t sc_string_words(uint32_t len) {
+    return STRING_WORDS(len);
+}
+
+uint32_t sc_vector_words(uint32_t len) {
+    return VECTOR_WORDS(len);
+}
+
+uint32_t sc_bytevector_words(uint32_t len) {
+    return RAW_VECTOR_WORDS(len, sizeof(uint8_t));
+}
+
+uint32_t sc_s64vector_words(uint32_t len) {
+    return RAW_VECTOR_WORDS(len, sizeof(int64_t));
+}
+
+uint32_t sc_f64vector_words(uint32_t len) {
+    return RAW_VECTOR_WORDS(len, sizeof(double));
+}
+
+uint32_t sc_primitive_words(void) {
+    return GC_WORDS(sizeof(sc_primitive));
+}
+
+uint32_t sc_record_words(uint32_t nfields) {
+    return RECORD_WORDS(nfields);
+}
+
+gc_handle sc_place_cons(void *mem) {
+    sc_cons *cons = mem;
+    cons->header.ops = &sc_cons_ops;
+    cons->car = cons->cdr = NIL;
+    return gc_tag_pointer(cons);
+}
+
+gc_handle sc_place_string(void *mem, uint32_t len) {
+    sc_string *str = mem;
+    str->header.ops = &sc_string_ops;
+    str->strlen = len;
+    return gc_tag_pointer(str);
+}
+
+gc_handle sc_place_vector(void *mem, uint32_t len) {
+    sc_vector *vec = mem;
+    uint32_t i;
+    vec->header.ops = &sc_vector_ops;
+    vec->veclen = len;
+    for(i = 0; i < len; i++) {
+        vec->vector[i] = NIL;
+    }
+    return gc_tag_pointer(vec);
+}
+
+/* The data is left as it was, for the caller to fill in */
+static gc_handle sc_place_raw_vector(void *mem, gc_ops *ops, uint32_t len) {
+    sc_raw_vector *vec = mem;
+    vec->header.ops = ops;
+    vec->len = len;
+    return gc_tag_pointer(vec);
+}
+
+gc_handle sc_place_bytevector(void *mem, uint32_t len) {
+    return sc_place_raw_vector(mem, &sc_bytevector_ops, len);
+}
+
+gc_handle sc_place_s64vector(void *mem, uint32_t len) {
+    return sc_place_raw_vector(mem, &sc_s64vector_ops, len);
+}
+
+gc_handle sc_place_f64vector(void *mem, uint32_t len) {
+    return sc_place_raw_vector(mem, &sc_f64vector_ops, len);
+}
+
+gc_handle sc_place_primitive(void *mem, void *code, sc_primitive_fn *fn) {
+    sc_primitive *prim = mem;
+    prim->header.ops = &sc_primitive_ops;
+    prim->code = code;
+    prim->fn   = fn;
+    return gc_tag_pointer(prim);
+}
+
+gc_handle sc_place_record(void *mem, gc_handle shape) {
+    sc_shape *s = UNTAG_PTR(shape, sc_shape);
+    sc_record *rec = mem;
+    uint32_t i;
+
+    /* The last collection can't have seen this record */
+    s->epoch = sc_epoch;
+    rec->header.ops = &s->ops;
+    for(i = 0; i < s->nfields; i++)
+        rec->fields[i] = s->bitmap[i / 32] >> (i % 32) & 1 ? NIL : 0;
+    return gc_tag_pointer(rec);
+}
+
 gc_handle sc_make_string(char *string) {
     uint32_t len = strlen(string);
     gc_handle s = sc_alloc_string(len+1);
@@ -222,9 +694,85 @@ gc_handle sc_make_string(char *string) {
     return s;
 }
 
+/* Word i of a bitmap for nfields fields, without the bits past the last */
+static inline uint32_t sc_bitmap_word(uint32_t nfields, const uint32_t *bitmap, uint32_t i) {
+    if(i < nfields / 32)
+        return bitmap[i];
+    return nfields % 32 ? bitmap[i] & ((1u << nfields % 32) - 1) : 0;
+}
+
+/*
+ * A new static shape. bitmap has a bit for each field, set for those
+ * that hold handles; bits past the last field are ignored.
+ */
+gc_handle sc_make_shape(uint32_t nfields, const uint32_t *bitmap) {
+    uint32_t i, words = SHAPE_WORDS(nfields);
+    sc_shape *shape, **p;
+
+    for(p = &sc_free_shapes; *p && SHAPE_WORDS((*p)->nfields) != words; p = &(*p)->next)
+        ;
+    if(*p) {
+        shape = *p;
+        *p = shape->next;
+    } else {
+        if((uintptr_t)(sc_shape_region_limit - sc_shape_region) < words) {
+            sc_shape_region = gc_alloc_region(MAX(words, SHAPE_REGION_WORDS));
+            sc_shape_region_limit = sc_shape_region + MAX(words, SHAPE_REGION_WORDS);
+        }
+        shape = (sc_shape*)sc_shape_region;
+        sc_shape_region += words;
+    }
+
+    shape->header.ops = &sc_shape_ops;
+    shape->ops.op_relocate = sc_relocate_record;
+    shape->ops.op_len      = sc_len_record;
+    shape->ops.op_mark     = NULL;
+    shape->epoch   = sc_epoch;
+    shape->nfields = nfields;
+    for(i = 0; i < BITMAP_LEN(nfields); i++)
+        shape->bitmap[i] = sc_bitmap_word(nfields, bitmap, i);
+    shape->next = sc_shapes;
+    sc_shapes   = shape;
+    return gc_tag_pointer(shape);
+}
+
+/*
+ * As for the VM's stack segments: a shape is garbage once a collection
+ * has found neither a handle to it nor a record of it, and nothing made
+ * since can refer to it. So we reuse those that the last collection
+ * didn't mark, unless they are newer than it.
+ */
+static void sc_sweep_shapes(void) {
+    sc_shape **p = &sc_shapes, *shape;
+
+    sc_epoch++;
+    while((shape = *p)) {
+        if(shape->epoch + 1 >= sc_epoch) {
+            p = &shape->next;
+            continue;
+        }
+        *p = shape->next;
+        shape->next = sc_free_shapes;
+        sc_free_shapes = shape;
+    }
+}
+
 void sc_init() {
-    sc_true = gc_tag_pointer(gc_alloc(&sc_boolean_ops, 2));
+    sc_shape *shape;
+
+    /* Nothing in a new heap can refer to the shapes made so far */
+    while((shape = sc_shapes)) {
+        sc_shapes = shape->next;
+        shape->next = sc_free_shapes;
+        sc_free_shapes = shape;
+    }
+    sc_epoch = 0;
+    gc_register_gc_root_hook(sc_sweep_shapes);
+
+    sc_true = sc_false = NIL;
+    gc_register_roots(&sc_true, &sc_false, NULL);
+    sc_true = gc_tag_pointer(gc_alloc(&sc_boolean_ops, GC_WORDS(sizeof(sc_boolean))));
     UNTAG_PTR(sc_true, sc_boolean)->val = 1;
-    sc_false = gc_tag_pointer(gc_alloc(&sc_boolean_ops, 2));
+    sc_false = gc_tag_pointer(gc_alloc(&sc_boolean_ops, GC_WORDS(sizeof(sc_boolean))));
     UNTAG_PTR(sc_false, sc_boolean)->val = 0;
 }
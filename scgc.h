@@ -3,13 +3,107 @@
 
 #include "gc.h"
 
+/*
+ * Primitive procedures take their arguments as a vector of handles
+ * which stays rooted for the duration of the call.
+ */
+typedef gc_handle sc_primitive_fn(gc_handle *argv, uint32_t argc);
+
+/* Type descriptors, exported for code that allocates inline */
+extern struct gc_ops sc_symbol_ops;
+extern struct gc_ops sc_string_ops;
+extern struct gc_ops sc_cons_ops;
+extern struct gc_ops sc_vector_ops;
+extern struct gc_ops sc_bytevector_ops;
+extern struct gc_ops sc_s64vector_ops;
+extern struct gc_ops sc_f64vector_ops;
+extern struct gc_ops sc_boolean_ops;
+extern struct gc_ops sc_closure_ops;
+extern struct gc_ops sc_primitive_ops;
+extern struct gc_ops sc_shape_ops;
+
+/*
+ * Records. A shape describes a record type: how many fields its
+ * records have, and a bitmap of which of them hold handles rather than
+ * raw 32-bit words. Each call to sc_make_shape makes a new one, so two
+ * record types with the same layout are still different types.
+ *
+ * Shapes live outside the heap and never move. Each carries the gc_ops
+ * of its records, so a record's header points into its shape and the
+ * collector finds the pointer fields straight from there. A shape is
+ * reused once a collection has found neither a handle to it nor any of
+ * its records.
+ *
+ * The layouts are exported for code that accesses fields inline.
+ */
+typedef struct sc_shape {
+    gc_chunk  header;
+    gc_ops    ops;              /* the header of each record of this shape */
+    struct sc_shape *next;      /* in sc_shapes or sc_free_shapes */
+    uint32_t  epoch;            /* of the last collection to find it in use */
+    uint32_t  nfields;
+    uint32_t  bitmap[];         /* bit n set: field n holds a handle */
+} sc_shape;
+
+typedef struct sc_record {
+    gc_chunk  header;
+    gc_handle fields[];
+} sc_record;
+
+/* Fields below this can be checked with bitmap[0] alone */
+#define SC_RECORD_FAST_FIELDS 32
+
+/*
+ * Whether r is a record of the given shape with a handle in field n,
+ * for n < SC_RECORD_FAST_FIELDS. The shape is only looked inside once
+ * r is known to have it.
+ */
+static inline int sc_record_fast_field(gc_handle shape, gc_handle r, uint32_t n) {
+    sc_shape *s = UNTAG_PTR(shape, sc_shape);
+    return gc_pointerp(r) && !NILP(r)
+        && UNTAG_PTR(r, gc_chunk)->ops == &s->ops
+        && (s->bitmap[0] >> n & 1);
+}
+
 /* Memory allocaton */
 gc_handle sc_alloc_cons();
+gc_handle sc_alloc_list(uint32_t n);
 gc_handle sc_alloc_string(uint32_t len);
 gc_handle sc_alloc_vector(uint32_t len);
+gc_handle sc_alloc_bytevector(uint32_t len);
+gc_handle sc_alloc_s64vector(uint32_t len);
+gc_handle sc_alloc_f64vector(uint32_t len);
 gc_handle sc_alloc_symbol(uint32_t len);
+gc_handle sc_alloc_closure(void *code, uint32_t nfree);
+gc_handle sc_alloc_primitive(void *code, sc_primitive_fn *fn);
+gc_handle sc_alloc_record(gc_handle shape);
+
+/*
+ * Laying objects out in memory from gc_alloc_batch, for code that
+ * allocates many at once. The sc_*_words functions give an object's
+ * size, and sc_place_* set one up at mem as the matching sc_alloc_*
+ * would, returning its handle.
+ */
+uint32_t sc_cons_words(void);
+uint32_t sc_string_words(uint32_t len);
+uint32_t sc_vector_words(uint32_t len);
+uint32_t sc_bytevector_words(uint32_t len);
+uint32_t sc_s64vector_words(uint32_t len);
+uint32_t sc_f64vector_words(uint32_t len);
+uint32_t sc_primitive_words(void);
+uint32_t sc_record_words(uint32_t nfields);
+
+gc_handle sc_place_cons(void *mem);
+gc_handle sc_place_string(void *mem, uint32_t len);
+gc_handle sc_place_vector(void *mem, uint32_t len);
+gc_handle sc_place_bytevector(void *mem, uint32_t len);
+gc_handle sc_place_s64vector(void *mem, uint32_t len);
+gc_handle sc_place_f64vector(void *mem, uint32_t len);
+gc_handle sc_place_primitive(void *mem, void *code, sc_primitive_fn *fn);
+gc_handle sc_place_record(void *mem, gc_handle shape);
 
 gc_handle sc_make_string(char * s);
+gc_handle sc_make_shape(uint32_t nfields, const uint32_t *bitmap);
 gc_handle sc_make_number(gc_int n);
 
 /* Accesors */
@@ -29,13 +123,53 @@ uint32_t sc_vector_len(gc_handle v);
 gc_handle sc_vector_ref(gc_handle v, uint32_t n);
 void sc_vector_set(gc_handle v, uint32_t n, gc_handle x);
 
+/*
+ * Bytevectors, s64vectors and f64vectors hold raw numbers that the
+ * collector never scans. The data pointers are good until the next
+ * allocation. Ranges are [start, end) in elements.
+ */
+uint32_t sc_bytevector_len(gc_handle v);
+uint8_t *sc_bytevector_data(gc_handle v);
+uint32_t sc_s64vector_len(gc_handle v);
+int64_t *sc_s64vector_data(gc_handle v);
+uint32_t sc_f64vector_len(gc_handle v);
+double *sc_f64vector_data(gc_handle v);
+
+void sc_bytevector_fill(gc_handle v, uint8_t x, uint32_t start, uint32_t end);
+void sc_s64vector_fill(gc_handle v, int64_t x, uint32_t start, uint32_t end);
+void sc_f64vector_fill(gc_handle v, double x, uint32_t start, uint32_t end);
+void sc_raw_vector_copy(gc_handle to, uint32_t at, gc_handle from, uint32_t start, uint32_t end);
+
+uint32_t sc_shape_len(gc_handle shape);
+int sc_shape_pointer_field(gc_handle shape, uint32_t n);
+gc_handle sc_record_shape(gc_handle r);
+gc_handle sc_record_ref(gc_handle r, uint32_t n);
+void sc_record_set(gc_handle r, uint32_t n, gc_handle x);
+int32_t sc_record_raw_ref(gc_handle r, uint32_t n);
+void sc_record_raw_set(gc_handle r, uint32_t n, int32_t x);
+
+uint32_t sc_closure_len(gc_handle c);
+gc_handle sc_closure_ref(gc_handle c, uint32_t n);
+void sc_closure_set(gc_handle c, uint32_t n, gc_handle x);
+void *sc_closure_code(gc_handle c);
+sc_primitive_fn *sc_primitive_get(gc_handle p);
+void *sc_primitive_code(gc_handle p);
+
 /* Predicates */
 int sc_consp(gc_handle c);
 int sc_stringp(gc_handle c);
 int sc_numberp(gc_handle c);
 int sc_symbolp(gc_handle c);
 int sc_vectorp(gc_handle c);
+int sc_bytevectorp(gc_handle c);
+int sc_s64vectorp(gc_handle c);
+int sc_f64vectorp(gc_handle c);
+int sc_raw_vectorp(gc_handle c);
 int sc_booleanp(gc_handle c);
+int sc_closurep(gc_handle c);
+int sc_primitivep(gc_handle c);
+int sc_shapep(gc_handle c);
+int sc_recordp(gc_handle c);
 
 extern gc_handle sc_true;
 extern gc_handle sc_false;
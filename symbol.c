@@ -14,17 +14,24 @@ void obarray_init() {
     gc_register_roots(&obarray, NULL);
 }
 
-gc_handle sc_intern_symbol(char * name) {
+/*
+ * Look name up in the obarray. Returns its index, and the symbol if
+ * there is one; otherwise the index of the first free slot, growing
+ * the obarray if there is none.
+ */
+static int obarray_lookup(char *name, gc_handle *sym) {
     int i;
     uint32_t len = sc_vector_len(obarray);
     gc_handle v = NIL;
     for(i = 0; i < len; i++) {
         v = sc_vector_ref(obarray, i);
         if(NILP(v)) break;
-        if(!strcmp(name, sc_symbol_name(v)))
-            return v;
+        if(!strcmp(name, sc_symbol_name(v))) {
+            *sym = v;
+            return i;
+        }
     }
-    /* Symbol not found, allocate one and stick it in the obarray */
+    *sym = NIL;
     if( i == len) {
         /* We ran off the end -- realloc the obarray */
         printf("Obarray realloc forced, new size %d\n", len << 1);
@@ -35,8 +42,31 @@ gc_handle sc_intern_symbol(char * name) {
         obarray = oa;
         i = len;
     }
-    v = sc_alloc_symbol(strlen(name));
+    return i;
+}
+
+gc_handle sc_intern_symbol(char * name) {
+    gc_handle v;
+    int i = obarray_lookup(name, &v);
+    if(!NILP(v))
+        return v;
+    /* Symbol not found, allocate one and stick it in the obarray */
+    v = sc_alloc_symbol(strlen(name) + 1);
     strcpy(sc_symbol_name(v), name);
     sc_vector_set(obarray, i, v);
     return v;
 }
+
+/*
+ * Intern a symbol that already exists outside the heap, such as one
+ * the compiler emitted as a static object. Returns the symbol of that
+ * name, which is sym itself unless one was interned before.
+ */
+gc_handle sc_intern_static_symbol(gc_handle sym) {
+    gc_handle v;
+    int i = obarray_lookup(sc_symbol_name(sym), &v);
+    if(!NILP(v))
+        return v;
+    sc_vector_set(obarray, i, sym);
+    return sym;
+}
@@ -5,5 +5,6 @@
 
 void obarray_init();
 gc_handle sc_intern_symbol(char * name);
+gc_handle sc_intern_static_symbol(gc_handle sym);
 
 #endif /* !defined(__MINISCHEME_SYMBOL__) */
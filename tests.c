@@ -1,9 +1,19 @@
 #include <check.h>
 #include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
 
 #include "gc.h"
 #include "scgc.h"
 #include "symbol.h"
+#include "reader.h"
+#include "writer.h"
+#include "fasl.h"
+#include "vm.h"
+#include "primitives.h"
 
 gc_handle reg1, reg2;
 
@@ -137,6 +147,131 @@ START_TEST(gc_basic_vector)
 }
 END_TEST
 
+START_TEST(gc_raw_vectors)
+{
+    int i;
+
+    reg1 = sc_alloc_s64vector(100);
+    reg2 = sc_alloc_cons();
+    fail_unless(sc_s64vectorp(reg1) && !sc_vectorp(reg1));
+    fail_unless(sc_s64vector_len(reg1) == 100);
+    for(i = 0; i < 100; i++)
+        fail_unless(sc_s64vector_data(reg1)[i] == 0);
+
+    /* A raw element that looks like a handle is left alone */
+    sc_s64vector_fill(reg1, -1, 0, 100);
+    sc_s64vector_data(reg1)[0] = reg2;
+    sc_s64vector_data(reg1)[1] = (int64_t)1 << 40;
+    gc_gc();
+    fail_unless(sc_s64vectorp(reg1));
+    fail_unless(sc_s64vector_data(reg1)[0] != reg2);
+    fail_unless(sc_s64vector_data(reg1)[1] == (int64_t)1 << 40);
+    fail_unless(sc_s64vector_data(reg1)[99] == -1);
+
+    /* Overlapping copies */
+    for(i = 0; i < 100; i++)
+        sc_s64vector_data(reg1)[i] = i;
+    sc_raw_vector_copy(reg1, 10, reg1, 0, 50);
+    fail_unless(sc_s64vector_data(reg1)[9] == 9);
+    fail_unless(sc_s64vector_data(reg1)[10] == 0);
+    fail_unless(sc_s64vector_data(reg1)[59] == 49);
+    fail_unless(sc_s64vector_data(reg1)[60] == 60);
+
+    reg1 = sc_alloc_bytevector(13);
+    sc_bytevector_fill(reg1, 0xab, 2, 12);
+    reg2 = sc_alloc_bytevector(13);
+    sc_raw_vector_copy(reg2, 0, reg1, 1, 13);
+    gc_gc();
+    fail_unless(sc_bytevector_data(reg2)[0] == 0);
+    fail_unless(sc_bytevector_data(reg2)[1] == 0xab);
+    fail_unless(sc_bytevector_data(reg2)[10] == 0xab);
+    fail_unless(sc_bytevector_data(reg2)[11] == 0);
+    fail_unless(((uintptr_t)sc_bytevector_data(reg2) & (sizeof(uintptr_t) - 1)) == 0);
+
+    reg1 = sc_alloc_f64vector(7);
+    sc_f64vector_fill(reg1, 2.5, 0, 7);
+    gc_gc();
+    fail_unless(sc_f64vectorp(reg1) && sc_f64vector_len(reg1) == 7);
+    fail_unless(sc_f64vector_data(reg1)[6] == 2.5);
+}
+END_TEST
+
+START_TEST(gc_records)
+{
+    uint32_t bitmap[2] = { ~(1u << 1), 1u << 3 };
+    gc_handle shape;
+    int i;
+
+    /* Field 1 is raw, and holds what looks like a handle to reg2 */
+    shape = sc_make_shape(3, bitmap);
+    fail_unless(sc_shapep(shape) && sc_shape_len(shape) == 3);
+    fail_unless(sc_shape_pointer_field(shape, 0) && !sc_shape_pointer_field(shape, 1));
+    reg1 = sc_alloc_record(shape);
+    fail_unless(sc_recordp(reg1) && sc_record_shape(reg1) == shape);
+    fail_unless(NILP(sc_record_ref(reg1, 0)) && sc_record_raw_ref(reg1, 1) == 0);
+    reg2 = sc_alloc_cons();
+    sc_set_car(reg2, sc_make_number(5));
+    sc_record_set(reg1, 0, reg2);
+    sc_record_raw_set(reg1, 1, reg2);
+    sc_record_set(reg1, 2, sc_make_string("field"));
+
+    fail_unless(sc_record_fast_field(shape, reg1, 0));
+    fail_unless(!sc_record_fast_field(shape, reg1, 1));
+    fail_unless(!sc_record_fast_field(shape, reg1, 3));
+    fail_unless(!sc_record_fast_field(sc_make_shape(3, bitmap), reg1, 0));
+    fail_unless(!sc_record_fast_field(shape, reg2, 0));
+    fail_unless(!sc_record_fast_field(shape, NIL, 0));
+
+    gc_gc();
+    fail_unless(sc_recordp(reg1) && sc_record_shape(reg1) == shape);
+    fail_unless(sc_record_ref(reg1, 0) == reg2);
+    fail_unless(sc_number(sc_car(reg2)) == 5);
+    fail_unless(sc_record_raw_ref(reg1, 1) != (int32_t)reg2);
+    fail_unless(!strcmp(sc_string_get(sc_record_ref(reg1, 2)), "field"));
+
+    /* Past the first bitmap word, only field 35 holds a handle */
+    bitmap[0] = 0;
+    shape = sc_make_shape(40, bitmap);
+    reg1 = sc_alloc_record(shape);
+    for(i = 0; i < 40; i++) {
+        if(i != 35)
+            sc_record_raw_set(reg1, i, i);
+    }
+    sc_record_set(reg1, 35, sc_alloc_cons());
+    gc_gc();
+    fail_unless(sc_consp(sc_record_ref(reg1, 35)));
+    fail_unless(sc_record_raw_ref(reg1, 34) == 34 && sc_record_raw_ref(reg1, 39) == 39);
+}
+END_TEST
+
+START_TEST(gc_shapes)
+{
+    uint32_t bitmap[1] = { 1 };
+    gc_handle shape;
+    int i;
+
+    /* Every call makes a new type, even for the same layout */
+    reg1 = sc_alloc_record(sc_make_shape(2, bitmap));
+    sc_record_set(reg1, 0, sc_make_string("field"));
+    reg2 = sc_make_shape(2, bitmap);
+    fail_unless(reg2 != sc_record_shape(reg1));
+
+    /* One that nothing refers to is reused once a collection misses it */
+    shape = sc_make_shape(2, bitmap);
+    gc_gc();
+    gc_gc();
+    fail_unless(sc_make_shape(2, bitmap) == shape);
+
+    /* Those with a handle or a record are not */
+    for(i = 0; i < 8; i++) {
+        shape = sc_make_shape(2, bitmap);
+        fail_unless(shape != reg2 && shape != sc_record_shape(reg1));
+    }
+    fail_unless(sc_shapep(reg2) && sc_shape_len(reg2) == 2);
+    fail_unless(!strcmp(sc_string_get(sc_record_ref(reg1, 0)), "field"));
+}
+END_TEST
+
 START_TEST(gc_large_allocs)
 {
     int i;
@@ -174,6 +309,27 @@ START_TEST(gc_many_allocs)
 }
 END_TEST
 
+START_TEST(gc_closures)
+{
+    reg1 = sc_alloc_closure(NULL, 2);
+    reg2 = sc_alloc_cons();
+    sc_set_car(reg2, sc_make_number(7));
+    sc_closure_set(reg1, 0, reg2);
+    sc_closure_set(reg1, 1, sc_make_number(8));
+    reg2 = sc_alloc_primitive(NULL, NULL);
+
+    gc_gc();
+
+    fail_unless(sc_closurep(reg1));
+    fail_unless(!sc_primitivep(reg1));
+    fail_unless(sc_primitivep(reg2));
+    fail_unless(sc_closure_len(reg1) == 2);
+    fail_unless(sc_consp(sc_closure_ref(reg1, 0)));
+    fail_unless(sc_number(sc_car(sc_closure_ref(reg1, 0))) == 7);
+    fail_unless(sc_number(sc_closure_ref(reg1, 1)) == 8);
+}
+END_TEST
+
 gc_handle external_root;
 void gc_reloc_external() {
     gc_relocate(&external_root);
@@ -194,9 +350,43 @@ START_TEST(gc_root_hook)
 }
 END_TEST
 
+static gc_chunk *outside_obj;
+static void gc_reloc_outside() {
+    if(outside_obj)
+        gc_relocate_object(outside_obj);
+}
+
+START_TEST(gc_outside_objects)
+{
+    gc_handle outside, str;
+
+    outside_obj = NULL;
+    gc_register_gc_root_hook(gc_reloc_outside);
+
+    reg1 = sc_alloc_cons();
+    sc_set_car(reg1, sc_make_string("outside"));
+    sc_set_cdr(reg1, NIL);
+
+    outside = gc_tag_pointer(gc_alloc_region(GC_WORDS(sizeof(gc_chunk) + 2 * sizeof(gc_handle))));
+    memcpy(UNTAG_PTR(outside, gc_chunk), UNTAG_PTR(reg1, gc_chunk),
+           gc_object_len(UNTAG_PTR(reg1, gc_chunk)) * sizeof(uintptr_t));
+    outside_obj = UNTAG_PTR(outside, gc_chunk);
+    str = sc_car(outside);
+    reg1 = NIL;
+
+    gc_gc();
+
+    fail_unless(UNTAG_PTR(outside, gc_chunk) == outside_obj);
+    fail_unless(sc_consp(outside));
+    fail_unless(sc_car(outside) != str);
+    fail_unless(sc_stringp(sc_car(outside)));
+    fail_unless(!strcmp(sc_string_get(sc_car(outside)), "outside"));
+}
+END_TEST
+
 START_TEST(gc_roots)
 {
-    gc_handle reg;
+    gc_handle reg = NIL;
 
     gc_register_roots(&reg, NULL);
 
@@ -270,6 +460,763 @@ START_TEST(obarray_realloc)
 }
 END_TEST
 
+START_TEST(obarray_static_symbol)
+{
+    gc_handle sym;
+
+    reg1 = sc_alloc_symbol(strlen("static") + 1);
+    strcpy(sc_symbol_name(reg1), "static");
+    sym = gc_tag_pointer(gc_alloc_region(gc_object_len(UNTAG_PTR(reg1, gc_chunk))));
+    memcpy(UNTAG_PTR(sym, gc_chunk), UNTAG_PTR(reg1, gc_chunk),
+           gc_object_len(UNTAG_PTR(reg1, gc_chunk)) * sizeof(uintptr_t));
+
+    fail_unless(sc_intern_static_symbol(sym) == sym);
+    gc_gc();
+    fail_unless(sc_intern_symbol("static") == sym);
+    fail_unless(sc_intern_static_symbol(reg1) == sym);
+    fail_unless(!strcmp(sc_symbol_name(sym), "static"));
+}
+END_TEST
+
+START_TEST(reader_basic)
+{
+    sc_read_error err;
+    const char *src = "(a (b . 3) \"two\nlines\" 'q #t -12) ; comment\n42 ()";
+    gc_handle form;
+
+    fail_unless(sc_read_buffer(src, strlen(src), &reg1, &err) == 0);
+
+    form = sc_car(reg1);
+    fail_unless(sc_car(form) == sc_intern_symbol("a"));
+    form = sc_cdr(form);
+    fail_unless(sc_car(sc_car(form)) == sc_intern_symbol("b"));
+    fail_unless(sc_number(sc_cdr(sc_car(form))) == 3);
+    form = sc_cdr(form);
+    fail_unless(!strcmp(sc_string_get(sc_car(form)), "two\nlines"));
+    form = sc_cdr(form);
+    fail_unless(sc_car(sc_car(form)) == sc_intern_symbol("quote"));
+    fail_unless(sc_car(sc_cdr(sc_car(form))) == sc_intern_symbol("q"));
+    form = sc_cdr(form);
+    fail_unless(sc_car(form) == sc_true);
+    form = sc_cdr(form);
+    fail_unless(sc_number(sc_car(form)) == -12);
+    fail_unless(NILP(sc_cdr(form)));
+
+    fail_unless(sc_number(sc_car(sc_cdr(reg1))) == 42);
+    fail_unless(NILP(sc_car(sc_cdr(sc_cdr(reg1)))));
+    fail_unless(NILP(sc_cdr(sc_cdr(sc_cdr(reg1)))));
+}
+END_TEST
+
+static int read_fails(const char *src, uint32_t line, uint32_t column) {
+    sc_read_error err;
+    gc_handle forms = NIL;
+    return sc_read_buffer(src, strlen(src), &forms, &err) == -1
+        && NILP(forms) && err.line == line && err.column == column;
+}
+
+START_TEST(reader_errors)
+{
+    fail_unless(read_fails("(a b", 1, 5));
+    fail_unless(read_fails("a\n  )", 2, 3));
+    fail_unless(read_fails("(a . b c)", 1, 8));
+    fail_unless(read_fails("(. a)", 1, 2));
+    fail_unless(read_fails("'", 1, 2));
+    fail_unless(read_fails("\"abc", 1, 1));
+    fail_unless(read_fails("(1 99999999999)", 1, 4));
+    fail_unless(read_fails("(a \"x\ny", 1, 4));
+    fail_unless(read_fails("(a 1abc)", 1, 4));
+    fail_unless(read_fails("x|y", 1, 1));
+}
+END_TEST
+
+/* Enough data to need several collections and a realloc on the way */
+START_TEST(reader_file)
+{
+    char path[] = "/tmp/flnv-reader-XXXXXX";
+    sc_read_error err;
+    gc_handle l;
+    FILE *f;
+    int i, fd;
+
+    fd = mkstemp(path);
+    fail_unless(fd >= 0);
+    f = fdopen(fd, "w");
+    for(i = 0; i < 1000; i++)
+        fprintf(f, "(%d sym%d \"str\" (nested '(list %d)))\n", i, i % 10, i);
+    fclose(f);
+
+    fail_unless(sc_read_file(path, &reg1, &err) == 0);
+    unlink(path);
+
+    for(i = 0, l = reg1; i < 1000; i++, l = sc_cdr(l)) {
+        reg2 = sc_car(l);
+        fail_unless(sc_number(sc_car(reg2)) == i);
+        /* (nested (quote (list i))) */
+        reg2 = sc_car(sc_cdr(sc_cdr(sc_cdr(reg2))));
+        reg2 = sc_car(sc_cdr(sc_car(sc_cdr(reg2))));
+        fail_unless(sc_number(sc_car(sc_cdr(reg2))) == i);
+    }
+    fail_unless(NILP(l));
+    fail_unless(sc_read_file(path, &reg1, &err) == -1 && err.line == 0);
+}
+END_TEST
+
+static int writes(gc_handle v, int flags, const char *expected) {
+    char buf[256];
+    return sc_write_to_buffer(buf, sizeof(buf), v, flags) == strlen(expected)
+        && !strcmp(buf, expected);
+}
+
+static gc_handle read_one(const char *src) {
+    sc_read_error err;
+    fail_unless(sc_read_buffer(src, strlen(src), &reg1, &err) == 0);
+    return sc_car(reg1);
+}
+
+START_TEST(writer_basic)
+{
+    const char *src = "(a (b . 3) \"s\" -12 (#t #f) ())";
+    gc_handle s;
+
+    fail_unless(writes(read_one(src), 0, src));
+    fail_unless(writes(read_one(src), SC_WRITE_DISPLAY, "(a (b . 3) s -12 (#t #f) ())"));
+    fail_unless(writes(sc_make_number(-536870912), 0, "-536870912"));
+    fail_unless(writes(NIL, 0, "()"));
+
+    s = sc_make_string("say \"\\\"");
+    fail_unless(writes(s, 0, "\"say \\\"\\\\\\\"\""));
+    fail_unless(writes(s, SC_WRITE_DISPLAY, "say \"\\\""));
+
+    reg2 = sc_alloc_vector(3);
+    sc_vector_set(reg2, 0, sc_make_number(1));
+    s = read_one("(x y)");
+    sc_vector_set(reg2, 1, s);
+    fail_unless(writes(reg2, 0, "#(1 (x y) ())"));
+    fail_unless(writes(sc_alloc_vector(0), 0, "#()"));
+
+    reg2 = sc_alloc_bytevector(3);
+    sc_bytevector_data(reg2)[1] = 255;
+    fail_unless(writes(reg2, 0, "#u8(0 255 0)"));
+    reg2 = sc_alloc_s64vector(2);
+    sc_s64vector_data(reg2)[0] = INT64_MIN;
+    sc_s64vector_data(reg2)[1] = INT64_MAX;
+    fail_unless(writes(reg2, 0, "#s64(-9223372036854775808 9223372036854775807)"));
+    reg2 = sc_alloc_f64vector(4);
+    sc_f64vector_data(reg2)[0] = 0.1;
+    sc_f64vector_data(reg2)[1] = -3;
+    sc_f64vector_data(reg2)[2] = 1e300;
+    sc_f64vector_data(reg2)[3] = -1.0 / 0.0;
+    fail_unless(writes(reg2, 0, "#f64(0.1 -3.0 1e+300 -inf.0)"));
+    fail_unless(writes(sc_alloc_f64vector(0), 0, "#f64()"));
+}
+END_TEST
+
+START_TEST(writer_cycles)
+{
+    /* The graph from gc_cons_cycle */
+    reg1 = sc_alloc_cons();
+    reg2 = sc_alloc_cons();
+    sc_set_car(reg1, reg1);
+    sc_set_cdr(reg1, reg2);
+    sc_set_car(reg2, reg1);
+    sc_set_cdr(reg2, reg1);
+    fail_unless(writes(reg1, 0, "#0=(#0# #0# . #0#)"));
+
+    /* A circular list, and a vector containing itself */
+    reg1 = read_one("(1 2)");
+    sc_set_cdr(sc_cdr(reg1), reg1);
+    fail_unless(writes(reg1, 0, "#0=(1 2 . #0#)"));
+    reg2 = sc_alloc_vector(2);
+    sc_vector_set(reg2, 0, reg2);
+    sc_vector_set(reg2, 1, reg1);
+    fail_unless(writes(reg2, 0, "#0=#(#0# #1=(1 2 . #1#))"));
+
+    /* Sharing without a cycle needs no labels */
+    reg1 = read_one("((1))");
+    reg2 = sc_alloc_cons();
+    sc_set_car(reg2, sc_car(reg1));
+    sc_set_cdr(reg1, reg2);
+    fail_unless(writes(reg1, 0, "((1) (1))"));
+}
+END_TEST
+
+/* Long enough to go around the output buffer more than once */
+START_TEST(writer_output)
+{
+    char small[8], *big;
+    size_t len, i;
+    int fds[2];
+    FILE *f;
+
+    reg1 = read_one("(abc def ghi)");
+    fail_unless(sc_write_to_buffer(small, sizeof(small), reg1, 0) == 13);
+    fail_unless(!strcmp(small, "(abc de"));
+    fail_unless(sc_write_to_buffer(NULL, 0, reg1, 0) == 13);
+
+    reg1 = NIL;
+    for(i = 0; i < 20000; i++) {
+        reg2 = sc_alloc_cons();
+        sc_set_car(reg2, sc_make_number(i));
+        sc_set_cdr(reg2, reg1);
+        reg1 = reg2;
+    }
+    len = sc_write_to_buffer(NULL, 0, reg1, 0);
+    big = malloc(len + 1);
+    fail_unless(sc_write_to_buffer(big, len + 1, reg1, 0) == len);
+    fail_unless(!strncmp(big, "(19999 19998 ", 13));
+    fail_unless(!strcmp(big + len - 5, " 1 0)"));
+
+    f = tmpfile();
+    fail_unless(sc_write(fileno(f), reg1, 0) == 0);
+    fail_unless(lseek(fileno(f), 0, SEEK_CUR) == len);
+    rewind(f);
+    for(i = 0; i < len && fgetc(f) == big[i]; i++)
+        ;
+    fail_unless(i == len);
+    fclose(f);
+    free(big);
+
+    fail_unless(pipe(fds) == 0);
+    close(fds[0]);
+    signal(SIGPIPE, SIG_IGN);
+    fail_unless(sc_write(fds[1], reg1, 0) == -1 && errno == EPIPE);
+    close(fds[1]);
+
+    /* A string bigger than the output buffer, followed by more data */
+    len = 70000;
+    big = malloc(len + 1);
+    memset(big, 'x', len);
+    big[len] = '\0';
+    reg1 = sc_alloc_cons();
+    sc_set_cdr(reg1, sc_make_number(12345));
+    reg2 = sc_make_string(big);
+    sc_set_car(reg1, reg2);
+    f = tmpfile();
+    fail_unless(sc_write(fileno(f), reg1, 0) == 0);
+    fail_unless(lseek(fileno(f), 0, SEEK_CUR) == len + 12);
+    rewind(f);
+    fail_unless(fgetc(f) == '(' && fgetc(f) == '"');
+    for(i = 0; i < len && fgetc(f) == 'x'; i++)
+        ;
+    fail_unless(i == len);
+    for(i = 0; i < 10 && fgetc(f) == "\" . 12345)"[i]; i++)
+        ;
+    fail_unless(i == 10);
+    fclose(f);
+    fail_unless(!strcmp(sc_string_get(sc_car(reg1)), big));
+    free(big);
+}
+END_TEST
+
+/* Write reg1 to a file and read it back into reg2 */
+static void fasl_round_trip(void) {
+    FILE *f = tmpfile();
+
+    fail_unless(sc_fasl_write(fileno(f), reg1) == 0);
+    lseek(fileno(f), 0, SEEK_SET);
+    reg2 = NIL;
+    fail_unless(sc_fasl_read(fileno(f), &reg2) == 0);
+    fclose(f);
+}
+
+static gc_handle fasl_test_primitive(gc_handle *argv UNUSED, uint32_t argc UNUSED) {
+    return NIL;
+}
+
+START_TEST(fasl_types)
+{
+    const char *src = "(a (b . 3) \"str\" -536870912 (#t #f) () 536870911 a)";
+    char before[256], after[256];
+    uint32_t bitmap[2] = { ~2u, ~8u };
+    gc_handle v, shape;
+
+    reg1 = read_one(src);
+    fasl_round_trip();
+    fail_unless(writes(reg2, 0, src));
+    fail_unless(sc_car(reg2) == sc_intern_symbol("a"));
+    fail_unless(sc_car(sc_car(sc_cdr(sc_cdr(sc_cdr(sc_cdr(reg2)))))) == sc_true);
+
+    /* Primitives go by name, and take this process's code */
+    reg1 = sc_alloc_vector(2);
+    v = sc_alloc_primitive((void*)0x5678, rt_find_primitive("car"));
+    sc_vector_set(reg1, 0, v);
+    sc_vector_set(reg1, 1, sc_make_string("in a vector"));
+    sc_write_to_buffer(before, sizeof(before), reg1, 0);
+    fasl_round_trip();
+    sc_write_to_buffer(after, sizeof(after), reg2, 0);
+    fail_unless(!strcmp(before, after));
+    v = sc_vector_ref(reg2, 0);
+    fail_unless(sc_primitive_get(v) == rt_find_primitive("car"));
+    fail_unless(sc_primitive_code(v) == rt_primitive_code);
+
+    reg1 = sc_alloc_vector(3);
+    v = sc_alloc_bytevector(5);
+    sc_vector_set(reg1, 0, v);
+    sc_bytevector_fill(v, 7, 1, 4);
+    v = sc_alloc_s64vector(2);
+    sc_vector_set(reg1, 1, v);
+    sc_s64vector_data(v)[1] = INT64_MIN;
+    v = sc_alloc_f64vector(1);
+    sc_vector_set(reg1, 2, v);
+    sc_f64vector_data(v)[0] = 0.25;
+    sc_write_to_buffer(before, sizeof(before), reg1, 0);
+    fasl_round_trip();
+    sc_write_to_buffer(after, sizeof(after), reg2, 0);
+    fail_unless(!strcmp(before, after));
+    fail_unless(!strcmp(after, "#(#u8(0 7 7 7 0) #s64(0 -9223372036854775808) #f64(0.25))"));
+
+    /* A record that refers to itself, with raw fields in both bitmap words */
+    shape = sc_make_shape(40, bitmap);
+    reg1 = sc_alloc_cons();
+    sc_set_cdr(reg1, shape);
+    reg2 = sc_alloc_record(shape);
+    sc_set_car(reg1, reg2);
+    reg2 = sc_make_string("field");
+    v = sc_car(reg1);
+    sc_record_set(v, 0, v);
+    sc_record_raw_set(v, 1, -7);
+    sc_record_raw_set(v, 35, 123);
+    sc_record_set(v, 39, reg2);
+    fasl_round_trip();
+    v = sc_car(reg2);
+    fail_unless(sc_recordp(v) && sc_shapep(sc_cdr(reg2)));
+    fail_unless(sc_record_shape(v) == sc_cdr(reg2));
+    /* The loaded type is a new one with the same layout */
+    fail_unless(sc_cdr(reg2) != sc_cdr(reg1));
+    fail_unless(sc_shape_len(sc_cdr(reg2)) == 40);
+    fail_unless(!sc_shape_pointer_field(sc_cdr(reg2), 35));
+    fail_unless(sc_shape_pointer_field(sc_cdr(reg2), 36));
+    fail_unless(sc_record_ref(v, 0) == v);
+    fail_unless(sc_record_raw_ref(v, 1) == -7);
+    fail_unless(sc_record_raw_ref(v, 35) == 123);
+    fail_unless(NILP(sc_record_ref(v, 38)));
+    fail_unless(!strcmp(sc_string_get(sc_record_ref(v, 39)), "field"));
+
+    reg1 = sc_make_number(-5);
+    fasl_round_trip();
+    fail_unless(sc_number(reg2) == -5);
+    reg1 = sc_intern_symbol("lone");
+    fasl_round_trip();
+    fail_unless(reg2 == reg1);
+}
+END_TEST
+
+START_TEST(fasl_sharing)
+{
+    gc_handle a, b;
+
+    /* The graph from gc_cons_cycle */
+    reg1 = sc_alloc_cons();
+    reg2 = sc_alloc_cons();
+    sc_set_car(reg1, reg1);
+    sc_set_cdr(reg1, reg2);
+    sc_set_car(reg2, reg1);
+    sc_set_cdr(reg2, reg1);
+    fasl_round_trip();
+    fail_unless(reg2 != reg1);
+    fail_unless(sc_car(reg2) == reg2);
+    fail_unless(sc_car(sc_cdr(reg2)) == reg2);
+    fail_unless(sc_cdr(sc_cdr(reg2)) == reg2);
+
+    /* Shared but acyclic structure stays shared */
+    reg1 = read_one("((x \"s\") y)");
+    reg2 = sc_alloc_cons();
+    sc_set_car(reg2, sc_car(reg1));
+    sc_set_cdr(sc_cdr(reg1), reg2);
+    fasl_round_trip();
+    fail_unless(writes(reg2, 0, "((x \"s\") y (x \"s\"))"));
+    a = sc_car(reg2);
+    b = sc_car(sc_cdr(sc_cdr(reg2)));
+    fail_unless(a == b);
+    gc_gc();
+    fail_unless(sc_car(reg2) == sc_car(sc_cdr(sc_cdr(reg2))));
+}
+END_TEST
+
+/* Long enough to span many buffers */
+START_TEST(fasl_large)
+{
+    gc_handle l;
+    int i;
+
+    reg1 = NIL;
+    for(i = 0; i < 50000; i++) {
+        reg2 = sc_alloc_cons();
+        sc_set_car(reg2, sc_make_number(i));
+        sc_set_cdr(reg2, reg1);
+        reg1 = reg2;
+    }
+    fasl_round_trip();
+    for(i = 49999, l = reg2; i >= 0; i--, l = sc_cdr(l))
+        fail_unless(sc_number(sc_car(l)) == i);
+    fail_unless(NILP(l));
+}
+END_TEST
+
+START_TEST(fasl_errors)
+{
+    FILE *f = tmpfile();
+    char buf[64], *name;
+    long len, cut;
+    int fd = fileno(f);
+
+    reg1 = read_one("(a #(1 \"two\") (b . c) #t)");
+    fail_unless(sc_fasl_write(fd, reg1) == 0);
+    len = lseek(fd, 0, SEEK_CUR);
+
+    /* Every truncation is an error, and leaves *v alone */
+    for(cut = len - 1; cut >= 0; cut--) {
+        fail_unless(ftruncate(fd, cut) == 0);
+        lseek(fd, 0, SEEK_SET);
+        reg2 = sc_make_number(1);
+        fail_unless(sc_fasl_read(fd, &reg2) == -1 && errno == EINVAL);
+        fail_unless(sc_number(reg2) == 1);
+    }
+
+    lseek(fd, 0, SEEK_SET);
+    fail_unless(write(fd, "FLNVfasl\x02", 9) == 9);
+    lseek(fd, 0, SEEK_SET);
+    fail_unless(sc_fasl_read(fd, &reg2) == -1 && errno == EINVAL);
+
+    /* Closures, and primitives that aren't ours, can't be written */
+    reg1 = sc_alloc_cons();
+    reg2 = sc_alloc_closure((void*)0x1234, 0);
+    sc_set_cdr(reg1, reg2);
+    fail_unless(sc_fasl_write(fd, reg1) == -1 && errno == EINVAL);
+    reg1 = sc_alloc_primitive(NULL, fasl_test_primitive);
+    fail_unless(sc_fasl_write(fd, reg1) == -1 && errno == EINVAL);
+
+    /* Nor can a primitive that this process doesn't have be loaded */
+    fail_unless(ftruncate(fd, 0) == 0);
+    lseek(fd, 0, SEEK_SET);
+    reg1 = sc_alloc_primitive(NULL, rt_find_primitive("car"));
+    fail_unless(sc_fasl_write(fd, reg1) == 0);
+    len = lseek(fd, 0, SEEK_CUR);
+    fail_unless(len < sizeof(buf));
+    lseek(fd, 0, SEEK_SET);
+    fail_unless(read(fd, buf, len) == len);
+    for(name = buf; name + 3 <= buf + len && memcmp(name, "car", 3); name++)
+        ;
+    fail_unless(name + 3 <= buf + len);
+    name[1] = 'x';
+    lseek(fd, 0, SEEK_SET);
+    fail_unless(write(fd, buf, len) == len);
+    lseek(fd, 0, SEEK_SET);
+    fail_unless(sc_fasl_read(fd, &reg2) == -1 && errno == EINVAL);
+    fclose(f);
+}
+END_TEST
+
+/* The native runtime binds each global that names a primitive to it */
+static gc_handle apply_primitive(const char *name, gc_int a, gc_int b) {
+    gc_handle argv[2];
+
+    argv[0] = sc_make_number(a);
+    argv[1] = sc_make_number(b);
+    return rt_find_primitive(name)(argv, 2);
+}
+
+START_TEST(primitives_arithmetic)
+{
+    fail_unless(sc_number(apply_primitive("+", FIXNUM_MAX - 1, 1)) == FIXNUM_MAX);
+    fail_unless(sc_number(apply_primitive("-", FIXNUM_MIN + 1, 1)) == FIXNUM_MIN);
+    fail_unless(sc_number(apply_primitive("*", FIXNUM_MIN / 2, 2)) == FIXNUM_MIN);
+    fail_unless(sc_number(apply_primitive("*", FIXNUM_MAX, 0)) == 0);
+}
+END_TEST
+
+/*
+ * Compiled code falls back on these when open-coded arithmetic
+ * overflows, and they must fail rather than wrap
+ */
+START_TEST(primitives_add_overflow)
+{
+    apply_primitive("+", FIXNUM_MAX, 1);
+}
+END_TEST
+
+START_TEST(primitives_sub_overflow)
+{
+    apply_primitive("-", FIXNUM_MIN, 1);
+}
+END_TEST
+
+START_TEST(primitives_mul_overflow)
+{
+    apply_primitive("*", FIXNUM_MIN, -1);
+}
+END_TEST
+
+static void vm_setup(void) {
+    vm_init();
+}
+
+/* Load and run an image, and check what it returns */
+static int vm_runs(const char *image, const char *expected) {
+    vm_program *prog;
+    const char *err;
+
+    prog = vm_load(read_one(image), &err);
+    fail_unless(prog != NULL);
+    reg2 = vm_run(prog);
+    vm_free(prog);
+    return writes(reg2, 0, expected);
+}
+
+/* Load and run an image, for tests that expect it to exit with an error */
+static void vm_run_image(const char *image) {
+    vm_program *prog;
+    const char *err;
+
+    prog = vm_load(read_one(image), &err);
+    fail_unless(prog != NULL);
+    vm_run(prog);
+}
+
+static int vm_rejects(const char *image, const char *expected) {
+    const char *err = NULL;
+    return vm_load(read_one(image), &err) == NULL && !strcmp(err, expected);
+}
+
+START_TEST(vm_basic)
+{
+    fail_unless(vm_runs("(flnv-bytecode 1 (constants (a \"s\")) (globals +)"
+                        " (procedure 0 0 fixnum 40 push fixnum 2 add 0"
+                        "  push const 0 cons halt))",
+                        "(42 a \"s\")"));
+    /* (if (< 1 2) 10 20) */
+    fail_unless(vm_runs("(flnv-bytecode 1 (constants) (globals <)"
+                        " (procedure 0 0 fixnum 1 push fixnum 2 lt 0"
+                        "  jump-false 13 fixnum 10 jump 15 fixnum 20 halt))",
+                        "10"));
+    /* ((lambda (x) (car x)) '(a)), with car called in tail position */
+    fail_unless(vm_runs("(flnv-bytecode 1 (constants (a)) (globals car)"
+                        " (procedure 0 0 frame 10 const 0 push closure 1 0 call 1 halt)"
+                        " (procedure 1 0 local 0 push global 0 tail-call 1))",
+                        "a"));
+    /* The fallback for an overflowing add calls the global it names */
+    fail_unless(vm_runs("(flnv-bytecode 1 (constants) (globals *)"
+                        " (procedure 0 0 fixnum 536870911 push fixnum 1 add 0 halt))",
+                        "536870911"));
+}
+END_TEST
+
+/* Overflow falls back on the primitive, which must fail rather than wrap */
+START_TEST(vm_add_overflow)
+{
+    vm_run_image("(flnv-bytecode 1 (constants) (globals +)"
+                 " (procedure 0 0 fixnum 536870911 push fixnum 1 add 0 halt))");
+}
+END_TEST
+
+START_TEST(vm_sub_overflow)
+{
+    vm_run_image("(flnv-bytecode 1 (constants) (globals -)"
+                 " (procedure 0 0 fixnum -536870912 push fixnum 1 sub 0 halt))");
+}
+END_TEST
+
+/*
+ * Compiled by flnvbc from
+ *
+ * (let ((l (cons 1 (cons 2 '()))) (k 10))
+ *   (let ((f (lambda (x) (cons x l))) (l (cons k l)))
+ *     (let ((loop (lambda (loop n acc)
+ *                   (if (= n 0)
+ *                       acc
+ *                       (loop loop (- n 1) (+ (car (cons 1 n)) acc))))))
+ *       (cons (f 5) (cons l (cons (loop loop 300000 0) '()))))))
+ *
+ * The loop runs for more iterations than there are frames, so it only
+ * finishes if tail calls run in constant space, and collects as it
+ * goes.
+ */
+static const char *vm_test_program =
+    "(flnv-bytecode 1\n"
+    "  (constants)\n"
+    "  (globals = - + car)\n"
+    "  (procedure 0 5\n"
+    "    fixnum 1 push fixnum 2 push nil cons cons set-local 0\n"
+    "    fixnum 10 set-local 1\n"
+    "    local 0 push closure 1 1 set-local 2\n"
+    "    local 1 push local 0 cons set-local 3\n"
+    "    closure 2 0 set-local 4\n"
+    "    frame 45 fixnum 5 push local 2 call 1 push\n"
+    "    local 3 push\n"
+    "    frame 64 local 4 push fixnum 300000 push fixnum 0 push local 4 call 3 push\n"
+    "    nil cons cons cons halt)\n"
+    "  (procedure 1 0\n"
+    "    local 0 push free 0 cons return)\n"
+    "  (procedure 3 0\n"
+    "    local 1 push fixnum 0 num-eq 0 jump-false 12\n"
+    "    local 2 return\n"
+    "    local 0 push local 1 push fixnum 1 sub 1 push\n"
+    "    frame 36 fixnum 1 push local 1 cons push global 3 call 1 push local 2 add 2 push\n"
+    "    local 0 tail-call 3))\n";
+
+START_TEST(vm_program_runs)
+{
+    fail_unless(vm_runs(vm_test_program, "((5 1 2) (10 1 2) 300000)"));
+}
+END_TEST
+
+/* (+ 1 (call/cc (lambda (k) (+ 10 (k 5))))) */
+static const char *vm_escape_program =
+    "(flnv-bytecode 1\n"
+    "  (constants)\n"
+    "  (globals + call/cc)\n"
+    "  (procedure 0 0\n"
+    "    fixnum 1 push frame 13 closure 1 0 push global 1 call 1 add 0 halt)\n"
+    "  (procedure 1 0\n"
+    "    fixnum 10 push frame 12 fixnum 5 push local 0 call 1 add 0 return))\n";
+
+/*
+ * (let ((deep (lambda (deep n)
+ *               (if (= n 0)
+ *                   (call/cc (lambda (k) (cons 0 k)))
+ *                   (let ((r (deep deep (- n 1))))
+ *                     (cons (+ (car r) 1) (cdr r)))))))
+ *   (let ((r (deep deep 20000)))
+ *     (if (< (car r) 60000)
+ *         ((cdr r) (cons (car r) (cdr r)))
+ *         (car r))))
+ *
+ * The continuation is captured under frames that fill several
+ * segments, and is then reentered twice, so each return through it
+ * has to bring those frames back.
+ */
+static const char *vm_reentry_program =
+    "(flnv-bytecode 1\n"
+    "  (constants)\n"
+    "  (globals = call/cc - + car cdr <)\n"
+    "  (procedure 0 2\n"
+    "    closure 1 0 set-local 0\n"
+    "    frame 17 local 0 push fixnum 20000 push local 0 call 2 set-local 1\n"
+    "    frame 28 local 1 push global 4 call 1 push fixnum 60000 lt 6 jump-false 71\n"
+    "    frame 69 frame 46 local 1 push global 4 call 1 push\n"
+    "    frame 56 local 1 push global 5 call 1 cons push\n"
+    "    frame 67 local 1 push global 5 call 1 call 1 jump 80\n"
+    "    frame 80 local 1 push global 4 call 1 halt)\n"
+    "  (procedure 2 1\n"
+    "    local 1 push fixnum 0 num-eq 0 jump-false 17\n"
+    "    closure 2 0 push global 1 tail-call 1\n"
+    "    frame 34 local 0 push local 1 push fixnum 1 sub 2 push local 0 call 2 set-local 2\n"
+    "    frame 45 local 2 push global 4 call 1 push fixnum 1 add 3 push\n"
+    "    frame 60 local 2 push global 5 call 1 cons return)\n"
+    "  (procedure 1 0\n"
+    "    fixnum 0 push local 0 cons return))\n";
+
+START_TEST(vm_continuations)
+{
+    fail_unless(vm_runs(vm_escape_program, "6"));
+    fail_unless(vm_runs(vm_reentry_program, "60000"));
+}
+END_TEST
+
+/*
+ * (let ((f (lambda (f n) (if (= n 0) 0 (+ 1 (f f (- n 1)))))))
+ *   (f f 100000))
+ *
+ * The recursion runs over a dozen stack segments deep.
+ */
+static const char *vm_deep_program =
+    "(flnv-bytecode 1\n"
+    "  (constants)\n"
+    "  (globals = - +)\n"
+    "  (procedure 0 1\n"
+    "    closure 1 0 set-local 0\n"
+    "    frame 17 local 0 push fixnum 100000 push local 0 call 2 halt)\n"
+    "  (procedure 2 0\n"
+    "    local 1 push fixnum 0 num-eq 0 jump-false 12\n"
+    "    fixnum 0 return\n"
+    "    fixnum 1 push\n"
+    "    frame 32 local 0 push local 1 push fixnum 1 sub 1 push local 0 call 2\n"
+    "    add 2 return))\n";
+
+/* Returning a batch of frames at a time takes a continuation per batch */
+START_TEST(vm_deep_return)
+{
+    vm_program *prog;
+    const char *err;
+    uint32_t free_mem;
+
+    prog = vm_load(read_one(vm_deep_program), &err);
+    fail_unless(prog != NULL);
+    gc_realloc(1 << 16);
+    free_mem = gc_free_mem();
+    reg2 = vm_run(prog);
+#ifndef TEST_STRESS_GC
+    fail_unless(free_mem - gc_free_mem() < 1000);
+#endif
+    fail_unless(writes(reg2, 0, "100000"));
+    vm_free(prog);
+}
+END_TEST
+
+/*
+ * (let ((point (make-record-type 3 '(2))))
+ *   (let ((p (make-record point 1 '(a) 7)))
+ *     (record-set! point p 0 (cons (record-ref point p 1) (record-ref point p 2)))
+ *     (record-set! point p 2 8)
+ *     (cons (record-ref point p 0) (record-ref point p 2))))
+ *
+ * Field 2 is raw, so accesses to it go through the primitives.
+ */
+static const char *vm_record_program =
+    "(flnv-bytecode 1\n"
+    "  (constants (2) (a))\n"
+    "  (globals make-record-type make-record record-set! record-ref)\n"
+    "  (procedure 0 2\n"
+    "    frame 12 fixnum 3 push const 0 push global 0 call 2 set-local 0\n"
+    "    frame 32 local 0 push fixnum 1 push const 1 push fixnum 7 push global 1 call 4\n"
+    "    set-local 1\n"
+    "    local 0 push local 1 push\n"
+    "    local 0 push local 1 record-ref 1 3 push\n"
+    "    local 0 push local 1 record-ref 2 3 cons record-set 0 2\n"
+    "    local 0 push local 1 push fixnum 8 record-set 2 2\n"
+    "    local 0 push local 1 record-ref 0 3 push\n"
+    "    local 0 push local 1 record-ref 2 3 cons halt))\n";
+
+START_TEST(vm_records)
+{
+    fail_unless(vm_runs(vm_record_program, "(((a) . 7) . 8)"));
+}
+END_TEST
+
+START_TEST(vm_load_errors)
+{
+    fail_unless(vm_rejects("(flnv-bytecode 2 (constants) (globals) (procedure 0 0 halt))",
+                           "not a version 1 bytecode image"));
+    fail_unless(vm_rejects("(flnv-bytecode 1 (globals) (procedure 0 0 halt))",
+                           "missing constants or globals"));
+    fail_unless(vm_rejects("(flnv-bytecode 1 (constants) (globals 3) (procedure 0 0 halt))",
+                           "malformed globals"));
+    fail_unless(vm_rejects("(flnv-bytecode 1 (constants) (globals) (procedure 0 0 frob))",
+                           "unknown instruction"));
+    fail_unless(vm_rejects("(flnv-bytecode 1 (constants) (globals) (procedure 0 0 fixnum))",
+                           "missing operand"));
+    /*
+     * No locals, a jump into an operand, a backward jump, a field too
+     * far for record-ref, and a missing procedure
+     */
+    fail_unless(vm_rejects("(flnv-bytecode 1 (constants) (globals) (procedure 0 0 local 0 halt))",
+                           "operand out of range"));
+    fail_unless(vm_rejects("(flnv-bytecode 1 (constants) (globals) (procedure 0 0 jump 1 halt))",
+                           "operand out of range"));
+    fail_unless(vm_rejects("(flnv-bytecode 1 (constants) (globals) (procedure 0 0 nil jump-false 0 halt))",
+                           "operand out of range"));
+    fail_unless(vm_rejects("(flnv-bytecode 1 (constants) (globals record-ref)"
+                           " (procedure 0 0 nil push nil record-ref 32 0 halt))",
+                           "operand out of range"));
+    fail_unless(vm_rejects("(flnv-bytecode 1 (constants) (globals) (procedure 0 0 closure 1 0 halt))",
+                           "operand out of range"));
+    fail_unless(vm_rejects("(flnv-bytecode 1 (constants) (globals) (procedure 0 0 nil))",
+                           "procedure doesn't end in a jump or return"));
+    fail_unless(vm_rejects("(flnv-bytecode 1 (constants) (globals) (procedure 1 0 halt))",
+                           "the top level takes arguments"));
+}
+END_TEST
 
 Suite *gc_suite()
 {
@@ -284,9 +1231,14 @@ Suite *gc_suite()
     tcase_add_test(tc_core, gc_frees_mem);
     tcase_add_test(tc_core, gc_cons_cycle);
     tcase_add_test(tc_core, gc_basic_vector);
+    tcase_add_test(tc_core, gc_raw_vectors);
+    tcase_add_test(tc_core, gc_records);
+    tcase_add_test(tc_core, gc_shapes);
     tcase_add_test(tc_core, gc_large_allocs);
     tcase_add_test(tc_core, gc_many_allocs);
+    tcase_add_test(tc_core, gc_closures);
     tcase_add_test(tc_core, gc_root_hook);
+    tcase_add_test(tc_core, gc_outside_objects);
     tcase_add_test(tc_core, gc_roots);
     tcase_add_test(tc_core, gc_live_roots);
     suite_add_tcase(s, tc_core);
@@ -301,8 +1253,79 @@ Suite *gc_suite()
                               obarray_teardown);
     tcase_add_test(tc_obarray, obarray_sancheck);
     tcase_add_test(tc_obarray, obarray_realloc);
+    tcase_add_test(tc_obarray, obarray_static_symbol);
     suite_add_tcase(s, tc_obarray);
 
+    TCase *tc_reader = tcase_create("reader");
+
+    tcase_add_checked_fixture(tc_reader,
+                              gc_core_setup,
+                              gc_core_teardown);
+    tcase_add_checked_fixture(tc_reader,
+                              obarray_setup,
+                              obarray_teardown);
+    tcase_add_test(tc_reader, reader_basic);
+    tcase_add_test(tc_reader, reader_errors);
+    tcase_add_test(tc_reader, reader_file);
+    suite_add_tcase(s, tc_reader);
+
+    TCase *tc_writer = tcase_create("writer");
+
+    tcase_add_checked_fixture(tc_writer,
+                              gc_core_setup,
+                              gc_core_teardown);
+    tcase_add_checked_fixture(tc_writer,
+                              obarray_setup,
+                              obarray_teardown);
+    tcase_add_test(tc_writer, writer_basic);
+    tcase_add_test(tc_writer, writer_cycles);
+    tcase_add_test(tc_writer, writer_output);
+    suite_add_tcase(s, tc_writer);
+
+    TCase *tc_fasl = tcase_create("fasl");
+
+    tcase_add_checked_fixture(tc_fasl,
+                              gc_core_setup,
+                              gc_core_teardown);
+    tcase_add_checked_fixture(tc_fasl,
+                              obarray_setup,
+                              obarray_teardown);
+    tcase_add_test(tc_fasl, fasl_types);
+    tcase_add_test(tc_fasl, fasl_sharing);
+    tcase_add_test(tc_fasl, fasl_large);
+    tcase_add_test(tc_fasl, fasl_errors);
+    suite_add_tcase(s, tc_fasl);
+
+    TCase *tc_primitives = tcase_create("primitives");
+
+    tcase_add_checked_fixture(tc_primitives,
+                              gc_core_setup,
+                              gc_core_teardown);
+    tcase_add_test(tc_primitives, primitives_arithmetic);
+    tcase_add_exit_test(tc_primitives, primitives_add_overflow, 3);
+    tcase_add_exit_test(tc_primitives, primitives_sub_overflow, 3);
+    tcase_add_exit_test(tc_primitives, primitives_mul_overflow, 3);
+    suite_add_tcase(s, tc_primitives);
+
+    TCase *tc_vm = tcase_create("vm");
+
+    tcase_add_checked_fixture(tc_vm,
+                              gc_core_setup,
+                              gc_core_teardown);
+    tcase_add_checked_fixture(tc_vm,
+                              obarray_setup,
+                              obarray_teardown);
+    tcase_add_checked_fixture(tc_vm, vm_setup, NULL);
+    tcase_add_test(tc_vm, vm_basic);
+    tcase_add_exit_test(tc_vm, vm_add_overflow, 3);
+    tcase_add_exit_test(tc_vm, vm_sub_overflow, 3);
+    tcase_add_test(tc_vm, vm_program_runs);
+    tcase_add_test(tc_vm, vm_continuations);
+    tcase_add_test(tc_vm, vm_deep_return);
+    tcase_add_test(tc_vm, vm_records);
+    tcase_add_test(tc_vm, vm_load_errors);
+    suite_add_tcase(s, tc_vm);
+
     return s;
 }
 
@@ -0,0 +1,1024 @@
+#include "vm.h"
+#include "scgc.h"
+#include "primitives.h"
+
+#include <string.h>
+
+enum vm_opcode {
+    VM_CONST,
+    VM_FIXNUM,
+    VM_NIL,
+    VM_TRUE,
+    VM_FALSE,
+    VM_LOCAL,
+    VM_SET_LOCAL,
+    VM_FREE,
+    VM_GLOBAL,
+    VM_PUSH,
+    VM_JUMP,
+    VM_JUMP_FALSE,
+    VM_CLOSURE,
+    VM_FRAME,
+    VM_CALL,
+    VM_TAIL_CALL,
+    VM_RETURN,
+    VM_HALT,
+    VM_CONS,
+    VM_ADD,
+    VM_SUB,
+    VM_LT,
+    VM_GT,
+    VM_NUM_EQ,
+    VM_RECORD_REF,
+    VM_RECORD_SET,
+    /* Only in the code of the builtin procedures */
+    VM_CALLCC,
+    VM_THROW,
+    VM_NOPS
+};
+
+/* What an operand refers to, for checking it as we load */
+enum vm_operand {
+    VM_OPERAND_NONE,
+    VM_OPERAND_CONST,           /* an index into the constants */
+    VM_OPERAND_FIXNUM,
+    VM_OPERAND_LOCAL,           /* an argument or slot of this procedure */
+    VM_OPERAND_COUNT,
+    VM_OPERAND_GLOBAL,
+    VM_OPERAND_TARGET,          /* a later instruction in this procedure */
+    VM_OPERAND_FIELD,           /* a field index below SC_RECORD_FAST_FIELDS */
+    VM_OPERAND_PROC             /* an index into the procedures */
+};
+
+/* The words in a frame record; see vm_push_frame */
+#define VM_FRAME_WORDS  4
+
+/* How much of a continuation to copy back at once; see vm_underflow */
+#define VM_UNDERFLOW_WORDS (VM_SEGMENT_SIZE / 2)
+
+static const struct {
+    const char      *name;
+    enum vm_operand operands[2];
+    uint32_t        pushes;     /* the most it grows the stack by */
+} vm_instructions[VM_NOPS] = {
+    [VM_CONST]      = { "const",      { VM_OPERAND_CONST } },
+    [VM_FIXNUM]     = { "fixnum",     { VM_OPERAND_FIXNUM } },
+    [VM_NIL]        = { "nil" },
+    [VM_TRUE]       = { "true" },
+    [VM_FALSE]      = { "false" },
+    [VM_LOCAL]      = { "local",      { VM_OPERAND_LOCAL } },
+    [VM_SET_LOCAL]  = { "set-local",  { VM_OPERAND_LOCAL } },
+    [VM_FREE]       = { "free",       { VM_OPERAND_COUNT } },
+    [VM_GLOBAL]     = { "global",     { VM_OPERAND_GLOBAL } },
+    [VM_PUSH]       = { "push",       { VM_OPERAND_NONE }, 1 },
+    [VM_JUMP]       = { "jump",       { VM_OPERAND_TARGET } },
+    [VM_JUMP_FALSE] = { "jump-false", { VM_OPERAND_TARGET } },
+    [VM_CLOSURE]    = { "closure",    { VM_OPERAND_PROC, VM_OPERAND_COUNT } },
+    [VM_FRAME]      = { "frame",      { VM_OPERAND_TARGET }, VM_FRAME_WORDS },
+    [VM_CALL]       = { "call",       { VM_OPERAND_COUNT } },
+    [VM_TAIL_CALL]  = { "tail-call",  { VM_OPERAND_COUNT } },
+    [VM_RETURN]     = { "return" },
+    [VM_HALT]       = { "halt" },
+    [VM_CONS]       = { "cons",       { VM_OPERAND_NONE }, 1 },
+    [VM_ADD]        = { "add",        { VM_OPERAND_GLOBAL }, 1 },
+    [VM_SUB]        = { "sub",        { VM_OPERAND_GLOBAL }, 1 },
+    [VM_LT]         = { "lt",         { VM_OPERAND_GLOBAL }, 1 },
+    [VM_GT]         = { "gt",         { VM_OPERAND_GLOBAL }, 1 },
+    [VM_NUM_EQ]     = { "num-eq",     { VM_OPERAND_GLOBAL }, 1 },
+    [VM_RECORD_REF] = { "record-ref", { VM_OPERAND_FIELD, VM_OPERAND_GLOBAL }, 2 },
+    [VM_RECORD_SET] = { "record-set", { VM_OPERAND_FIELD, VM_OPERAND_GLOBAL }, 2 },
+};
+
+/*
+ * Code is direct-threaded: each instruction is the address of the
+ * code that executes it, followed by its operands, so dispatch is a
+ * single indirect jump. Operands are fixnum handles, counts and
+ * indices, or pointers to jump targets and procedures.
+ */
+typedef struct vm_proc {
+    uint32_t arity;
+    uint32_t slots;             /* for Let bindings, after the arguments */
+    uint32_t depth;             /* the most a call grows the stack by */
+    void     **code;
+} vm_proc;
+
+struct vm_program {
+    vm_proc    *procs;
+    uint32_t   nprocs;
+    gc_handle  *constants;
+    uint32_t   nconstants;
+    gc_handle  *globals;        /* 0 for unbound */
+    char       **global_names;
+    uint32_t   nglobals;
+    vm_program *next;
+};
+
+/*
+ * The stack lives in fixed-size segments outside the heap, and calls
+ * and returns never allocate. A frame is its procedure's arguments and
+ * slots, followed by whatever it pushes. Below the arguments is the
+ * frame record pushed by the caller, which says where to return to.
+ *
+ * The stack proper runs from vm_base to vm_sp in the current segment,
+ * and is scanned as a root. Everything below it is a chain of
+ * continuations (Hieb, Dybvig and Bruggeman), starting at vm_next. A
+ * continuation is a heap object for a stretch of frames in some
+ * segment, which it keeps alive; those frames never change again.
+ *
+ * Capturing the continuation of a call just makes such an object for
+ * the stack below the callee's frame, and moves vm_base up to the
+ * frame. Overflowing a segment does the same, then moves the new
+ * frame to a fresh segment. The bottom frame of the stack has its
+ * frame record in vm_next, and returning from it copies the topmost
+ * frames of vm_next onto the stack, up to VM_UNDERFLOW_WORDS of them,
+ * leaving the rest in a new continuation. Since frames are copied
+ * before they run again, a continuation can be resumed any number of
+ * times.
+ *
+ * Code only jumps forwards, so the loader can bound how far each call
+ * grows the stack, and calls check for room just once on entry.
+ */
+typedef struct vm_segment {
+    struct vm_segment *next;    /* in vm_segments or vm_free_segments */
+    uint32_t          epoch;    /* of the last collection to find it in use */
+    gc_handle         *end;
+    gc_handle         slots[0];
+} vm_segment;
+
+typedef struct vm_continuation {
+    gc_chunk   header;
+    vm_segment *segment;
+    gc_handle  *base;           /* the frames */
+    gc_handle  *top;
+    void       **pc;            /* and where the topmost one resumes */
+    gc_handle  *fp;
+    gc_handle  env;
+    gc_handle  next;            /* the continuation below base, or nil */
+} vm_continuation;
+
+static void *vm_op_labels[VM_NOPS];
+
+/* The builtin procedures, which can't be written in bytecode */
+static void *vm_callcc_code[1], *vm_throw_code[1];
+static vm_proc vm_callcc_proc = { .arity = 1, .code = vm_callcc_code };
+static vm_proc vm_throw_proc  = { .arity = 1, .code = vm_throw_code };
+
+static const struct {
+    const char *name;
+    vm_proc    *proc;
+} vm_builtins[] = {
+    { "call/cc",                        &vm_callcc_proc },
+    { "call-with-current-continuation", &vm_callcc_proc },
+};
+
+#define VM_NBUILTINS (sizeof(vm_builtins) / sizeof(vm_builtins[0]))
+
+/* Loaded programs, whose constants and globals are roots */
+static vm_program *vm_programs;
+
+static vm_segment *vm_segments, *vm_free_segments;
+static vm_segment *vm_current;
+static uint32_t   vm_epoch;
+
+/*
+ * While the machine runs, its registers live in C locals. They are
+ * saved here around anything that can collect or touch the stack's
+ * segments, so that the collector can find and relocate them.
+ */
+static gc_handle vm_val, vm_env, vm_proc_reg, vm_next;
+static gc_handle *vm_base, *vm_limit, *vm_sp, *vm_fp;
+static void      **vm_pc;
+
+static gc_handle vm_execute(vm_program *prog, vm_proc *top);
+
+/* Frames */
+
+/*
+ * A frame record: the return address, the distance back to the
+ * caller's frame, and the caller's env. The collector scans records
+ * along with the rest of the stack, so all but env are fixnums; the
+ * return address, which fits in 48 bits, is split over two of them.
+ * Being relative, records stay valid when their frame is copied.
+ */
+static inline void vm_push_frame(gc_handle *rec, void **pc, gc_handle *fp, gc_handle env) {
+    rec[0] = gc_tag_number((uintptr_t)pc >> 24);
+    rec[1] = gc_tag_number((uintptr_t)pc & 0xffffff);
+    rec[2] = gc_tag_number(rec + VM_FRAME_WORDS - fp);
+    rec[3] = env;
+}
+
+static inline void **vm_frame_pc(gc_handle *rec) {
+    return (void**)((uintptr_t)gc_untag_number(rec[0]) << 24 | gc_untag_number(rec[1]));
+}
+
+static inline gc_handle *vm_frame_fp(gc_handle *rec) {
+    return rec + VM_FRAME_WORDS - gc_untag_number(rec[2]);
+}
+
+/* Continuations */
+
+static void vm_relocate_continuation(gc_chunk *c) {
+    vm_continuation *k = (vm_continuation*)c;
+    gc_handle *p;
+
+    gc_relocate(&k->env);
+    gc_relocate(&k->next);
+    k->segment->epoch = vm_epoch;
+    /* Harmless when the frames are shared with another continuation */
+    for(p = k->base; p < k->top; p++)
+        gc_relocate(p);
+}
+
+static uint32_t vm_len_continuation(gc_chunk *c UNUSED) {
+    return GC_WORDS(sizeof(vm_continuation));
+}
+
+static struct gc_ops vm_continuation_ops = {
+    .op_relocate = vm_relocate_continuation,
+    .op_len      = vm_len_continuation
+};
+
+/*
+ * The continuation for the frames from base up to the frame record
+ * rec, which says where the topmost one resumes. Fills in everything
+ * but next, which the caller must set before it next allocates.
+ */
+static vm_continuation *vm_alloc_continuation(vm_segment *seg, gc_handle *base, gc_handle *rec) {
+    vm_continuation *k = gc_alloc(&vm_continuation_ops, GC_WORDS(sizeof(vm_continuation)));
+
+    k->segment = seg;
+    k->base    = base;
+    k->top     = rec;
+    k->pc      = vm_frame_pc(rec);
+    k->fp      = vm_frame_fp(rec);
+    k->env     = rec[3];
+    k->next    = NIL;
+    return k;
+}
+
+/* Split the stack below the frame record rec off into vm_next */
+static void vm_capture(gc_handle *rec) {
+    vm_continuation *k = vm_alloc_continuation(vm_current, vm_base, rec);
+
+    k->next = vm_next;
+    vm_next = gc_tag_pointer(k);
+}
+
+/* Segments */
+
+static vm_segment *vm_new_segment(uint32_t need) {
+    vm_segment *seg;
+
+    if(need <= VM_SEGMENT_SIZE && vm_free_segments) {
+        seg = vm_free_segments;
+        vm_free_segments = seg->next;
+    } else {
+        need = MAX(need, (uint32_t)VM_SEGMENT_SIZE);
+        seg = malloc(sizeof(vm_segment) + need * sizeof(gc_handle));
+        assert(seg);
+        seg->end = seg->slots + need;
+    }
+    seg->epoch  = vm_epoch;
+    seg->next   = vm_segments;
+    vm_segments = seg;
+    return seg;
+}
+
+/* Start the stack afresh in a new segment with room for need words */
+static void vm_switch_segment(uint32_t need) {
+    vm_current = vm_new_segment(need);
+    vm_base    = vm_current->slots;
+    vm_limit   = vm_current->end;
+}
+
+/*
+ * A segment is garbage once a collection has found neither the stack
+ * nor any continuation using it, and nothing made since can refer to
+ * it. So we free those that the last collection didn't mark, unless
+ * they are newer than it.
+ */
+static void vm_sweep_segments(void) {
+    vm_segment **p = &vm_segments, *seg;
+
+    while((seg = *p)) {
+        if(seg == vm_current || seg->epoch + 1 >= vm_epoch) {
+            p = &seg->next;
+            continue;
+        }
+        *p = seg->next;
+        if(seg->end - seg->slots == VM_SEGMENT_SIZE) {
+            seg->next = vm_free_segments;
+            vm_free_segments = seg;
+        } else {
+            free(seg);
+        }
+    }
+}
+
+static void vm_free_segment_list(vm_segment *seg) {
+    vm_segment *next;
+
+    for(; seg; seg = next) {
+        next = seg->next;
+        free(seg);
+    }
+}
+
+/*
+ * On entry to a procedure whose frame won't fit in the segment: move
+ * its n arguments at vm_fp to a new one, and the frames below to a
+ * continuation.
+ */
+static void vm_overflow(uint32_t n, uint32_t depth) {
+    gc_handle *args = vm_fp;
+
+    if(vm_fp > vm_base)
+        vm_capture(vm_fp - VM_FRAME_WORDS);
+    vm_switch_segment(n + depth);
+    memcpy(vm_base, args, n * sizeof(gc_handle));
+    vm_fp = vm_base;
+    vm_sp = vm_base + n;
+}
+
+/* The procedure a frame with this env runs; the top level has none */
+static inline vm_proc *vm_frame_proc(vm_program *prog, gc_handle env) {
+    return NILP(env) ? &prog->procs[0] : sc_closure_code(env);
+}
+
+/*
+ * On return from the bottom frame, with the stack empty: resume the
+ * topmost frame of vm_next, by copying it onto the stack. The frames
+ * below it come along too, as many as fit in VM_UNDERFLOW_WORDS, so
+ * that returning through a deep stack splits off a new continuation
+ * once per batch rather than once per frame.
+ */
+static void vm_underflow(vm_program *prog) {
+    vm_continuation *k, *rest = NULL;
+    gc_handle *rec, *fp, *end, *reach;
+    uint32_t size;
+
+    if(NILP(vm_next))
+        rt_error("Return from the top level");
+    k = UNTAG_PTR(vm_next, vm_continuation);
+
+    /*
+     * Take frames down to fp, while each one still has room for its
+     * procedure's depth above it; end is the highest any of them reach.
+     */
+    fp  = k->fp;
+    end = k->top + vm_frame_proc(prog, k->env)->depth;
+    while(fp > k->base) {
+        rec   = fp - VM_FRAME_WORDS;
+        reach = MAX(end, rec + vm_frame_proc(prog, rec[3])->depth);
+        if(reach - vm_frame_fp(rec) > VM_UNDERFLOW_WORDS)
+            break;
+        end = reach;
+        fp  = vm_frame_fp(rec);
+    }
+    if(vm_base + (end - fp) > vm_limit)
+        vm_switch_segment(end - fp);
+    vm_sp = vm_base;
+
+    if(fp > k->base) {
+        rest = vm_alloc_continuation(k->segment, k->base, fp - VM_FRAME_WORDS);
+        k = UNTAG_PTR(vm_next, vm_continuation);
+        rest->next = k->next;
+    }
+    size = k->top - fp;
+    memcpy(vm_base, fp, size * sizeof(gc_handle));
+    vm_fp   = vm_base + (k->fp - fp);
+    vm_sp   = vm_base + size;
+    vm_pc   = k->pc;
+    vm_env  = k->env;
+    vm_next = rest ? gc_tag_pointer(rest) : k->next;
+}
+
+/*
+ * call/cc, with the procedure to call as its argument: make the stack
+ * below this frame a continuation, and replace the argument with a
+ * procedure that resumes it. The caller passes that on in a tail call.
+ */
+static void vm_callcc(void) {
+    gc_handle k;
+
+    if(vm_fp > vm_base) {
+        vm_capture(vm_fp - VM_FRAME_WORDS);
+        vm_base = vm_fp;
+    }
+    k = sc_alloc_closure(&vm_throw_proc, 1);
+    sc_closure_set(k, 0, vm_next);
+    vm_val   = vm_fp[0];
+    vm_fp[0] = k;
+}
+
+/* Roots */
+
+static void vm_relocate_roots(void) {
+    vm_program *prog;
+    gc_handle *p;
+    uint32_t i;
+
+    vm_epoch++;
+    vm_sweep_segments();
+    vm_current->epoch = vm_epoch;
+    for(p = vm_base; p < vm_sp; p++)
+        gc_relocate(p);
+    gc_relocate(&vm_val);
+    gc_relocate(&vm_env);
+    gc_relocate(&vm_proc_reg);
+    gc_relocate(&vm_next);
+    for(prog = vm_programs; prog; prog = prog->next) {
+        for(i = 0; i < prog->nconstants; i++)
+            gc_relocate(&prog->constants[i]);
+        for(i = 0; i < prog->nglobals; i++)
+            gc_relocate(&prog->globals[i]);
+    }
+}
+
+void vm_init(void) {
+    if(!vm_op_labels[0]) {
+        vm_execute(NULL, NULL);
+        vm_callcc_code[0] = vm_op_labels[VM_CALLCC];
+        vm_throw_code[0]  = vm_op_labels[VM_THROW];
+    }
+    vm_free_segment_list(vm_segments);
+    vm_free_segment_list(vm_free_segments);
+    vm_segments = vm_free_segments = NULL;
+    vm_epoch = 0;
+    vm_switch_segment(0);
+    vm_sp = vm_fp = vm_base;
+    vm_val = vm_env = vm_proc_reg = vm_next = NIL;
+    vm_programs = NULL;
+    gc_register_gc_root_hook(vm_relocate_roots);
+}
+
+/* Loading */
+
+static int vm_length(gc_handle l) {
+    int n = 0;
+    for(; sc_consp(l); l = sc_cdr(l))
+        n++;
+    return NILP(l) ? n : -1;
+}
+
+/* The elements of a list of the form (name ...), or 0 */
+static gc_handle vm_section(gc_handle form, const char *name) {
+    if(!sc_consp(form) || !sc_symbolp(sc_car(form))
+       || strcmp(sc_symbol_name(sc_car(form)), name) || vm_length(form) < 0)
+        return 0;
+    return sc_cdr(form);
+}
+
+static int vm_opcode(gc_handle v) {
+    int op;
+
+    if(!sc_symbolp(v))
+        return -1;
+    for(op = 0; op < VM_NOPS; op++) {
+        if(vm_instructions[op].name && !strcmp(sc_symbol_name(v), vm_instructions[op].name))
+            return op;
+    }
+    return -1;
+}
+
+/*
+ * Translate one procedure's instructions to threaded code: once to
+ * find where instructions start and how far they can grow the stack,
+ * then again to fill the code in.
+ */
+static const char *vm_load_procedure(vm_program *prog, vm_proc *proc, gc_handle form) {
+    gc_handle l, v;
+    uint32_t len, i, j = 0;
+    uint8_t *starts;
+    gc_int n;
+    int op = -1;
+
+    if(vm_length(form) < 2 || !sc_numberp(sc_car(form)) || !sc_numberp(sc_car(sc_cdr(form)))
+       || sc_number(sc_car(form)) < 0 || sc_number(sc_car(sc_cdr(form))) < 0)
+        return "malformed procedure";
+    proc->arity = sc_number(sc_car(form));
+    proc->slots = sc_number(sc_car(sc_cdr(form)));
+    proc->depth = proc->slots;
+    form = sc_cdr(sc_cdr(form));
+
+    len = vm_length(form);
+    starts = calloc(len + 1, 1);
+    assert(starts);
+    for(l = form, i = 0; !NILP(l); i++) {
+        if((op = vm_opcode(sc_car(l))) < 0) {
+            free(starts);
+            return "unknown instruction";
+        }
+        starts[i] = 1;
+        proc->depth += vm_instructions[op].pushes;
+        l = sc_cdr(l);
+        for(j = 0; j < 2 && vm_instructions[op].operands[j]; j++, i++) {
+            if(NILP(l) || !sc_numberp(sc_car(l))) {
+                free(starts);
+                return "missing operand";
+            }
+            l = sc_cdr(l);
+        }
+    }
+    /* Control must not run off the end */
+    if(len == 0 || (op != VM_TAIL_CALL && op != VM_RETURN && op != VM_HALT)) {
+        free(starts);
+        return "procedure doesn't end in a jump or return";
+    }
+
+    proc->code = malloc(len * sizeof(void*));
+    assert(proc->code);
+    for(l = form, i = 0; !NILP(l); l = sc_cdr(l), i++) {
+        v = sc_car(l);
+        if(starts[i]) {
+            op = vm_opcode(v);
+            proc->code[i] = vm_op_labels[op];
+            j = 0;
+            continue;
+        }
+        n = sc_number(v);
+        switch(vm_instructions[op].operands[j++]) {
+        case VM_OPERAND_CONST:
+            if(n < 0 || n >= prog->nconstants)
+                goto bad_operand;
+            break;
+        case VM_OPERAND_FIXNUM:
+            proc->code[i] = (void*)(uintptr_t)v;
+            continue;
+        case VM_OPERAND_LOCAL:
+            if(n < 0 || n >= proc->arity + proc->slots)
+                goto bad_operand;
+            break;
+        case VM_OPERAND_COUNT:
+            if(n < 0)
+                goto bad_operand;
+            break;
+        case VM_OPERAND_GLOBAL:
+            if(n < 0 || n >= prog->nglobals)
+                goto bad_operand;
+            break;
+        case VM_OPERAND_FIELD:
+            if(n < 0 || n >= SC_RECORD_FAST_FIELDS)
+                goto bad_operand;
+            break;
+        case VM_OPERAND_TARGET:
+            if(n <= i || n >= len || !starts[n])
+                goto bad_operand;
+            proc->code[i] = &proc->code[n];
+            continue;
+        case VM_OPERAND_PROC:
+            if(n < 0 || n >= prog->nprocs)
+                goto bad_operand;
+            proc->code[i] = &prog->procs[n];
+            continue;
+        case VM_OPERAND_NONE:
+            goto bad_operand;
+        }
+        proc->code[i] = (void*)n;
+    }
+    free(starts);
+    return NULL;
+
+bad_operand:
+    free(starts);
+    return "operand out of range";
+}
+
+vm_program *vm_load(gc_handle image, const char **err) {
+    gc_handle forms, constants, globals, l;
+    sc_primitive_fn *fn;
+    vm_program *prog;
+    const char *msg = NULL;
+    uint32_t i, j;
+
+    forms = vm_section(image, "flnv-bytecode");
+    if(!forms || NILP(forms) || sc_car(forms) != sc_make_number(1)) {
+        *err = "not a version 1 bytecode image";
+        return NULL;
+    }
+    forms = sc_cdr(forms);
+    if(vm_length(forms) < 3
+       || !(constants = vm_section(sc_car(forms), "constants"))
+       || !(globals = vm_section(sc_car(sc_cdr(forms)), "globals"))) {
+        *err = "missing constants or globals";
+        return NULL;
+    }
+    forms = sc_cdr(sc_cdr(forms));
+
+    prog = calloc(1, sizeof(vm_program));
+    assert(prog);
+    prog->nconstants = vm_length(constants);
+    prog->nglobals   = vm_length(globals);
+    prog->nprocs     = vm_length(forms);
+    prog->constants    = malloc(prog->nconstants * sizeof(gc_handle));
+    prog->globals      = calloc(prog->nglobals, sizeof(gc_handle));
+    prog->global_names = calloc(prog->nglobals, sizeof(char*));
+    prog->procs        = calloc(prog->nprocs, sizeof(vm_proc));
+    assert(prog->constants && prog->globals && prog->global_names && prog->procs);
+
+    for(l = constants, i = 0; !NILP(l); l = sc_cdr(l), i++)
+        prog->constants[i] = sc_car(l);
+    for(l = globals, i = 0; !NILP(l); l = sc_cdr(l), i++) {
+        if(!sc_symbolp(sc_car(l))) {
+            msg = "malformed globals";
+            goto fail;
+        }
+        prog->global_names[i] = strdup(sc_symbol_name(sc_car(l)));
+    }
+    for(l = forms, i = 0; !NILP(l); l = sc_cdr(l), i++) {
+        if(!vm_section(sc_car(l), "procedure")) {
+            msg = "malformed procedure";
+            goto fail;
+        }
+        if((msg = vm_load_procedure(prog, &prog->procs[i], sc_cdr(sc_car(l)))))
+            goto fail;
+    }
+    if(prog->procs[0].arity != 0) {
+        msg = "the top level takes arguments";
+        goto fail;
+    }
+
+    /* Only now allocate, with the constants already rooted */
+    prog->next  = vm_programs;
+    vm_programs = prog;
+    for(i = 0; i < prog->nglobals; i++) {
+        for(j = 0; j < VM_NBUILTINS; j++) {
+            if(!strcmp(prog->global_names[i], vm_builtins[j].name))
+                prog->globals[i] = sc_alloc_closure(vm_builtins[j].proc, 0);
+        }
+        if(!prog->globals[i] && (fn = rt_find_primitive(prog->global_names[i])))
+            prog->globals[i] = sc_alloc_primitive(NULL, fn);
+    }
+    return prog;
+
+fail:
+    vm_free(prog);
+    *err = msg;
+    return NULL;
+}
+
+void vm_free(vm_program *prog) {
+    vm_program **p;
+    uint32_t i;
+
+    for(p = &vm_programs; *p; p = &(*p)->next) {
+        if(*p == prog) {
+            *p = prog->next;
+            break;
+        }
+    }
+    for(i = 0; i < prog->nprocs; i++)
+        free(prog->procs[i].code);
+    for(i = 0; i < prog->nglobals; i++)
+        free(prog->global_names[i]);
+    free(prog->procs);
+    free(prog->constants);
+    free(prog->globals);
+    free(prog->global_names);
+    free(prog);
+}
+
+/* Running */
+
+gc_handle vm_run(vm_program *prog) {
+    return vm_execute(prog, &prog->procs[0]);
+}
+
+static void __attribute__((noreturn)) vm_error_unbound(vm_program *prog, uint32_t global) {
+    rt_error("Unbound variable: %s", prog->global_names[global]);
+}
+
+#define OPERAND         ((intptr_t)*pc++)
+#define NEXT            goto **pc++
+
+#define SAVE()          (vm_val = val, vm_env = env, vm_proc_reg = proc, \
+                         vm_pc = pc, vm_sp = sp, vm_fp = fp)
+#define RESTORE()       (val = vm_val, env = vm_env, proc = vm_proc_reg)
+/* After anything that can move the stack */
+#define LOAD()          (RESTORE(), pc = vm_pc, sp = vm_sp, fp = vm_fp, \
+                         base = vm_base, limit = vm_limit)
+
+/*
+ * Start running code with n arguments at fp, making room for the
+ * frame and clearing its slots
+ */
+#define ENTER(p, n)     do {                                    \
+        if(sp + (p)->depth > limit) {                           \
+            SAVE();                                             \
+            vm_overflow(n, (p)->depth);                         \
+            LOAD();                                             \
+        }                                                       \
+        for(i = 0; i < (p)->slots; i++)                         \
+            *sp++ = NIL;                                        \
+        pc = (p)->code;                                         \
+    } while(0)
+
+/* Both handles are fixnums exactly when bit 0 of their AND is set */
+#define FIXNUMS(a, b)   ((a) & (b) & 1)
+
+static gc_handle vm_execute(vm_program *prog, vm_proc *top) {
+    static void *const labels[VM_NOPS] = {
+        [VM_CONST]      = &&op_const,
+        [VM_FIXNUM]     = &&op_fixnum,
+        [VM_NIL]        = &&op_nil,
+        [VM_TRUE]       = &&op_true,
+        [VM_FALSE]      = &&op_false,
+        [VM_LOCAL]      = &&op_local,
+        [VM_SET_LOCAL]  = &&op_set_local,
+        [VM_FREE]       = &&op_free,
+        [VM_GLOBAL]     = &&op_global,
+        [VM_PUSH]       = &&op_push,
+        [VM_JUMP]       = &&op_jump,
+        [VM_JUMP_FALSE] = &&op_jump_false,
+        [VM_CLOSURE]    = &&op_closure,
+        [VM_FRAME]      = &&op_frame,
+        [VM_CALL]       = &&op_call,
+        [VM_TAIL_CALL]  = &&op_tail_call,
+        [VM_RETURN]     = &&op_return,
+        [VM_HALT]       = &&op_halt,
+        [VM_CONS]       = &&op_cons,
+        [VM_ADD]        = &&op_add,
+        [VM_SUB]        = &&op_sub,
+        [VM_LT]         = &&op_lt,
+        [VM_GT]         = &&op_gt,
+        [VM_NUM_EQ]     = &&op_num_eq,
+        [VM_RECORD_REF] = &&op_record_ref,
+        [VM_RECORD_SET] = &&op_record_set,
+        [VM_CALLCC]     = &&op_callcc,
+        [VM_THROW]      = &&op_throw,
+    };
+    void **pc;
+    gc_handle *sp, *fp, *base, *limit, val, env, proc, a;
+    vm_proc *callee;
+    intptr_t n, i;
+    int32_t r;
+
+    if(!prog) {
+        memcpy(vm_op_labels, labels, sizeof(labels));
+        return NIL;
+    }
+
+    base  = vm_base;
+    limit = vm_limit;
+    sp = fp = base;
+    pc = NULL;
+    val = env = proc = NIL;
+    ENTER(top, 0);
+    NEXT;
+
+op_const:
+    val = prog->constants[OPERAND];
+    NEXT;
+op_fixnum:
+    val = OPERAND;
+    NEXT;
+op_nil:
+    val = NIL;
+    NEXT;
+op_true:
+    val = sc_true;
+    NEXT;
+op_false:
+    val = sc_false;
+    NEXT;
+op_local:
+    val = fp[OPERAND];
+    NEXT;
+op_set_local:
+    fp[OPERAND] = val;
+    NEXT;
+op_free:
+    val = sc_closure_ref(env, OPERAND);
+    NEXT;
+op_global:
+    n = OPERAND;
+    val = prog->globals[n];
+    if(!val)
+        vm_error_unbound(prog, n);
+    NEXT;
+op_push:
+    *sp++ = val;
+    NEXT;
+op_jump:
+    pc = *pc;
+    NEXT;
+op_jump_false:
+    if(val == sc_false)
+        pc = *pc;
+    else
+        pc++;
+    NEXT;
+
+/* The captured values are on the stack */
+op_closure:
+    callee = *pc++;
+    n = OPERAND;
+    SAVE();
+    a = sc_alloc_closure(callee, n);
+    RESTORE();
+    val = a;
+    for(i = 0; i < n; i++)
+        sc_closure_set(val, i, sp[i - n]);
+    sp -= n;
+    NEXT;
+
+/* Before the arguments of a call that returns to the operand */
+op_frame:
+    vm_push_frame(sp, *pc++, fp, env);
+    sp += VM_FRAME_WORDS;
+    NEXT;
+
+/*
+ * Calls take the procedure in val and n arguments on the stack. A
+ * closure gets a frame starting at its arguments; a primitive runs
+ * on them in place, and returns at once.
+ */
+op_call:
+    n = OPERAND;
+    proc = val;
+    if(sc_closurep(proc)) {
+        callee = sc_closure_code(proc);
+        if(callee->arity != n)
+            rt_error_arity(n);
+        fp  = sp - n;
+        env = proc;
+        ENTER(callee, n);
+        NEXT;
+    }
+    if(!sc_primitivep(proc))
+        rt_error("Attempt to apply a non-procedure");
+    SAVE();
+    a = sc_primitive_get(proc)(sp - n, n);
+    RESTORE();
+    val = a;
+    sp -= n + VM_FRAME_WORDS;
+    pc = vm_frame_pc(sp);
+    NEXT;
+
+/* The arguments replace the caller's, and the callee returns for it */
+op_tail_call:
+    n = OPERAND;
+tail_call:
+    proc = val;
+    memmove(fp, sp - n, n * sizeof(gc_handle));
+    sp = fp + n;
+    if(sc_closurep(proc)) {
+        callee = sc_closure_code(proc);
+        if(callee->arity != n)
+            rt_error_arity(n);
+        env = proc;
+        ENTER(callee, n);
+        NEXT;
+    }
+    if(!sc_primitivep(proc))
+        rt_error("Attempt to apply a non-procedure");
+    SAVE();
+    a = sc_primitive_get(proc)(sp - n, n);
+    RESTORE();
+    val = a;
+    goto op_return;
+
+op_return:
+    if(fp == base)
+        goto underflow;
+    sp  = fp - VM_FRAME_WORDS;
+    pc  = vm_frame_pc(sp);
+    fp  = vm_frame_fp(sp);
+    env = sp[3];
+    NEXT;
+
+underflow:
+    sp = fp = base;
+    SAVE();
+    vm_underflow(prog);
+    LOAD();
+    NEXT;
+
+op_halt:
+    vm_sp = vm_fp = vm_base;
+    vm_val = vm_env = vm_proc_reg = vm_next = NIL;
+    return val;
+
+op_callcc:
+    SAVE();
+    vm_callcc();
+    LOAD();
+    n = 1;
+    goto tail_call;
+
+/* Resume the continuation in env with our argument, abandoning the stack */
+op_throw:
+    val = fp[0];
+    vm_next = sc_closure_ref(env, 0);
+    goto underflow;
+
+/* cons and the arithmetic operators take their first operand on the stack */
+op_cons:
+    *sp++ = val;
+    SAVE();
+    a = sc_alloc_cons();
+    RESTORE();
+    val = a;
+    sc_set_car(val, sp[-2]);
+    sc_set_cdr(val, sp[-1]);
+    sp -= 2;
+    NEXT;
+
+/*
+ * Arithmetic on fixnum handles works as in FLNV.Compile: adjusting one
+ * operand by the tag makes the result come out tagged, and overflow
+ * exactly when it is out of range. Anything else falls back on the
+ * primitive, whose global is the operand.
+ */
+op_add:
+    a = sp[-1];
+    if(FIXNUMS(a, val) && !__builtin_add_overflow((int32_t)a - 1, (int32_t)val, &r)) {
+        val = r;
+        sp--;
+        pc++;
+        NEXT;
+    }
+    goto primitive;
+op_sub:
+    a = sp[-1];
+    if(FIXNUMS(a, val) && !__builtin_sub_overflow((int32_t)a + 1, (int32_t)val, &r)) {
+        val = r;
+        sp--;
+        pc++;
+        NEXT;
+    }
+    goto primitive;
+op_lt:
+    a = sp[-1];
+    if(FIXNUMS(a, val)) {
+        val = (int32_t)a < (int32_t)val ? sc_true : sc_false;
+        sp--;
+        pc++;
+        NEXT;
+    }
+    goto primitive;
+op_gt:
+    a = sp[-1];
+    if(FIXNUMS(a, val)) {
+        val = (int32_t)a > (int32_t)val ? sc_true : sc_false;
+        sp--;
+        pc++;
+        NEXT;
+    }
+    goto primitive;
+op_num_eq:
+    a = sp[-1];
+    if(FIXNUMS(a, val)) {
+        val = a == val ? sc_true : sc_false;
+        sp--;
+        pc++;
+        NEXT;
+    }
+    goto primitive;
+
+primitive:
+    n = 2;
+    *sp++ = val;
+primitive_n:
+    i = OPERAND;
+    proc = prog->globals[i];
+    if(!proc)
+        vm_error_unbound(prog, i);
+    SAVE();
+    a = sc_primitive_get(proc)(sp - n, n);
+    RESTORE();
+    val = a;
+    sp -= n;
+    NEXT;
+
+/*
+ * Field n of a record whose type is on the stack, with the record in
+ * val, or for record-set, the record on the stack and the new value in
+ * val. Pointer fields of a record of the right type are a fixed offset
+ * away; for anything else, record-ref or record-set! sorts it out.
+ */
+op_record_ref:
+    n = OPERAND;
+    if(sc_record_fast_field(sp[-1], val, n)) {
+        val = UNTAG_PTR(val, sc_record)->fields[n];
+        sp--;
+        pc++;
+        NEXT;
+    }
+    *sp++ = val;
+    *sp++ = sc_make_number(n);
+    n = 3;
+    goto primitive_n;
+op_record_set:
+    n = OPERAND;
+    if(sc_record_fast_field(sp[-2], sp[-1], n)) {
+        UNTAG_PTR(sp[-1], sc_record)->fields[n] = val;
+        sp -= 2;
+        pc++;
+        NEXT;
+    }
+    *sp++ = sc_make_number(n);
+    *sp++ = val;
+    n = 4;
+    goto primitive_n;
+}
@@ -0,0 +1,50 @@
+#ifndef __FLNV_VM_H__
+#define __FLNV_VM_H__
+
+#include "gc.h"
+
+/*
+ * A virtual machine for the bytecode that FLNV.Bytecode compiles: a
+ * portable backend that needs neither the native code generator nor
+ * an assembler.
+ *
+ * A program image is itself an S-expression, read with the C reader:
+ *
+ *   (flnv-bytecode 1
+ *     (constants datum ...)
+ *     (globals name ...)
+ *     (procedure arity slots instruction ...)
+ *     ...)
+ *
+ * Each instruction is a mnemonic followed by its integer operands.
+ * Jump targets are word offsets within the procedure, and must be
+ * later than the jump. Closure operands index the list of procedures.
+ * Procedure 0, which takes no arguments, is the top level.
+ *
+ * The machine has the SICP registers (see notes): val, env (the
+ * current closure), proc, and continue, which is the return address
+ * in the record that the frame instruction pushes before a call's
+ * arguments. Frames live on a stack of segments outside the heap,
+ * which makes continuations cheap to capture; call/cc is a global.
+ */
+
+/* In handles */
+#define VM_SEGMENT_SIZE (1 << 16)
+
+typedef struct vm_program vm_program;
+
+/* Set up the machine. Call after gc_init, sc_init and obarray_init. */
+void vm_init(void);
+
+/*
+ * Load a program from its image. Returns NULL and sets *err if the
+ * image is malformed.
+ */
+vm_program *vm_load(gc_handle image, const char **err);
+
+/* Run a program's top level and return its value */
+gc_handle vm_run(vm_program *prog);
+
+void vm_free(vm_program *prog);
+
+#endif
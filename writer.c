@@ -0,0 +1,402 @@
+#include "writer.h"
+#include "scgc.h"
+#include "graph.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WRITER_BUFFER_SIZE      (64 * 1024)
+#define WRITER_TABLE_INITIAL    256
+#define WRITER_STACK_INITIAL    64
+
+/*
+ * Output goes either to the caller's buffer, or to a buffer of our own
+ * that is flushed to a file descriptor when it fills.
+ */
+typedef struct wr_out {
+    char   *buf;
+    size_t size;
+    size_t used;
+    size_t total;               /* bytes produced, including any cut off */
+    int    fd;                  /* -1 when writing to the caller's buffer */
+    int    error;               /* errno from a failed write */
+} wr_out;
+
+/*
+ * What we know about each pair and vector in the graph, in the flags
+ * of its graph table entry; the entry's value is its label, once
+ * printed. The collector can't run while we write.
+ */
+#define WR_ON_PATH  0x01        /* an ancestor of the object being visited */
+#define WR_CYCLE    0x02        /* reachable from itself: needs a label */
+#define WR_PRINTED  0x04        /* its label has been defined */
+
+/* An explicit stack, so that deep structures don't need a deep C stack */
+enum wr_item_kind {
+    WR_DATUM,                   /* write obj */
+    WR_LIST_REST,               /* the rest of a list after obj's car */
+    WR_VECTOR_REST,             /* the elements of obj from index on */
+    WR_CLOSE,                   /* a ) after a dotted tail */
+    WR_VISIT                    /* search the children of obj from index on */
+};
+
+typedef struct wr_item {
+    enum wr_item_kind kind;
+    gc_handle obj;
+    uint32_t index;
+} wr_item;
+
+typedef struct wr_stack {
+    wr_item *items;
+    uint32_t size, depth;
+} wr_stack;
+
+typedef struct writer {
+    wr_out   out;
+    sc_graph_table table;
+    wr_stack stack;
+    uint32_t labels;
+    int      flags;
+} writer;
+
+/* Output */
+
+static void wr_flush(wr_out *o, const char *p, size_t n) {
+    if(!o->error)
+        o->error = sc_write_all(o->fd, p, n);
+}
+
+static void wr_bytes(wr_out *o, const char *s, size_t n) {
+    size_t room;
+
+    o->total += n;
+    if(o->fd < 0) {
+        room = o->used + 1 < o->size ? o->size - o->used - 1 : 0;
+        if(n > room)
+            n = room;
+        if(n)
+            memcpy(o->buf + o->used, s, n);
+        o->used += n;
+        return;
+    }
+    if(o->used + n > o->size) {
+        wr_flush(o, o->buf, o->used);
+        o->used = 0;
+    }
+    if(n > o->size) {
+        wr_flush(o, s, n);
+        return;
+    }
+    memcpy(o->buf + o->used, s, n);
+    o->used += n;
+}
+
+static inline void wr_string(wr_out *o, const char *s) {
+    wr_bytes(o, s, strlen(s));
+}
+
+static void wr_unsigned(wr_out *o, uint64_t n) {
+    char digits[24], *p = digits + sizeof(digits);
+
+    do {
+        *--p = '0' + n % 10;
+        n /= 10;
+    } while(n);
+    wr_bytes(o, p, digits + sizeof(digits) - p);
+}
+
+static void wr_number(wr_out *o, int64_t n) {
+    if(n < 0) {
+        wr_bytes(o, "-", 1);
+        wr_unsigned(o, -(uint64_t)n);
+    } else {
+        wr_unsigned(o, n);
+    }
+}
+
+/* The shortest decimal that reads back as x, always with a point */
+static void wr_double(wr_out *o, double x) {
+    char digits[32];
+    int precision;
+
+    if(isnan(x)) {
+        wr_string(o, "+nan.0");
+        return;
+    } else if(isinf(x)) {
+        wr_string(o, x < 0 ? "-inf.0" : "+inf.0");
+        return;
+    }
+    for(precision = 1; precision < 17; precision++) {
+        snprintf(digits, sizeof(digits), "%.*g", precision, x);
+        if(strtod(digits, NULL) == x)
+            break;
+    }
+    snprintf(digits, sizeof(digits), "%.*g", precision, x);
+    wr_string(o, digits);
+    if(!strpbrk(digits, ".e"))
+        wr_bytes(o, ".0", 2);
+}
+
+/* Bytevectors, s64vectors and f64vectors, in the SRFI 4 syntax */
+static void wr_raw_vector(wr_out *o, gc_handle v) {
+    uint32_t i, len;
+
+    if(sc_bytevectorp(v)) {
+        wr_bytes(o, "#u8(", 4);
+        for(i = 0, len = sc_bytevector_len(v); i < len; i++) {
+            if(i)
+                wr_bytes(o, " ", 1);
+            wr_unsigned(o, sc_bytevector_data(v)[i]);
+        }
+    } else if(sc_s64vectorp(v)) {
+        wr_bytes(o, "#s64(", 5);
+        for(i = 0, len = sc_s64vector_len(v); i < len; i++) {
+            if(i)
+                wr_bytes(o, " ", 1);
+            wr_number(o, sc_s64vector_data(v)[i]);
+        }
+    } else {
+        wr_bytes(o, "#f64(", 5);
+        for(i = 0, len = sc_f64vector_len(v); i < len; i++) {
+            if(i)
+                wr_bytes(o, " ", 1);
+            wr_double(o, sc_f64vector_data(v)[i]);
+        }
+    }
+    wr_bytes(o, ")", 1);
+}
+
+/* The stack */
+
+static void wr_push(wr_stack *s, enum wr_item_kind kind, gc_handle obj, uint32_t index) {
+    wr_item *item;
+
+    if(s->depth == s->size) {
+        s->size <<= 1;
+        s->items = realloc(s->items, s->size * sizeof(wr_item));
+        assert(s->items);
+    }
+    item = &s->items[s->depth++];
+    item->kind  = kind;
+    item->obj   = obj;
+    item->index = index;
+}
+
+static inline int wr_compound(gc_handle v) {
+    return sc_consp(v) || sc_vectorp(v);
+}
+
+/*
+ * Find the objects that need labels, with a depth-first search: an
+ * edge back to an object on the current path closes a cycle.
+ */
+static void wr_find_cycles(writer *w, gc_handle root) {
+    wr_item *item;
+    sc_graph_entry *e;
+    gc_handle child;
+    uint32_t n;
+
+    if(!wr_compound(root))
+        return;
+    sc_graph_insert(&w->table, UNTAG_PTR(root, gc_chunk))->flags = WR_ON_PATH;
+    wr_push(&w->stack, WR_VISIT, root, 0);
+
+    while(w->stack.depth) {
+        item = &w->stack.items[w->stack.depth - 1];
+        n = sc_consp(item->obj) ? 2 : sc_vector_len(item->obj);
+        if(item->index == n) {
+            sc_graph_lookup(&w->table, UNTAG_PTR(item->obj, gc_chunk))->flags &= ~WR_ON_PATH;
+            w->stack.depth--;
+            continue;
+        }
+        if(sc_consp(item->obj))
+            child = item->index++ ? sc_cdr(item->obj) : sc_car(item->obj);
+        else
+            child = sc_vector_ref(item->obj, item->index++);
+        if(!wr_compound(child))
+            continue;
+
+        e = sc_graph_lookup(&w->table, UNTAG_PTR(child, gc_chunk));
+        if(!e->obj) {
+            sc_graph_insert(&w->table, UNTAG_PTR(child, gc_chunk))->flags = WR_ON_PATH;
+            wr_push(&w->stack, WR_VISIT, child, 0);
+        } else if(e->flags & WR_ON_PATH) {
+            e->flags |= WR_CYCLE;
+        }
+    }
+}
+
+/* Writing */
+
+static void wr_atom(writer *w, gc_handle v) {
+    const char *s, *special;
+
+    if(sc_numberp(v)) {
+        wr_number(&w->out, sc_number(v));
+    } else if(NILP(v)) {
+        wr_bytes(&w->out, "()", 2);
+    } else if(sc_booleanp(v)) {
+        wr_bytes(&w->out, v == sc_true ? "#t" : "#f", 2);
+    } else if(sc_symbolp(v)) {
+        wr_string(&w->out, sc_symbol_name(v));
+    } else if(sc_stringp(v) && (w->flags & SC_WRITE_DISPLAY)) {
+        wr_string(&w->out, sc_string_get(v));
+    } else if(sc_stringp(v)) {
+        wr_bytes(&w->out, "\"", 1);
+        for(s = sc_string_get(v); *s; s = special + 1) {
+            special = strpbrk(s, "\"\\");
+            if(!special) {
+                wr_string(&w->out, s);
+                break;
+            }
+            wr_bytes(&w->out, s, special - s);
+            wr_bytes(&w->out, "\\", 1);
+            wr_bytes(&w->out, special, 1);
+        }
+        wr_bytes(&w->out, "\"", 1);
+    } else if(sc_raw_vectorp(v)) {
+        wr_raw_vector(&w->out, v);
+    } else if(sc_closurep(v) || sc_primitivep(v)) {
+        wr_string(&w->out, "#<procedure>");
+    } else if(sc_recordp(v)) {
+        wr_string(&w->out, "#<record>");
+    } else if(sc_shapep(v)) {
+        wr_string(&w->out, "#<record-type>");
+    } else {
+        wr_string(&w->out, "#<object>");
+    }
+}
+
+/* Write a label reference and return 1, or define the label if needed */
+static int wr_label(writer *w, gc_handle v) {
+    sc_graph_entry *e = sc_graph_lookup(&w->table, UNTAG_PTR(v, gc_chunk));
+
+    if(!(e->flags & WR_CYCLE))
+        return 0;
+    wr_bytes(&w->out, "#", 1);
+    if(e->flags & WR_PRINTED) {
+        wr_unsigned(&w->out, e->value);
+        wr_bytes(&w->out, "#", 1);
+        return 1;
+    }
+    e->flags |= WR_PRINTED;
+    e->value = w->labels++;
+    wr_unsigned(&w->out, e->value);
+    wr_bytes(&w->out, "=", 1);
+    return 0;
+}
+
+static inline int wr_labelled(writer *w, gc_handle v) {
+    return sc_graph_lookup(&w->table, UNTAG_PTR(v, gc_chunk))->flags & WR_CYCLE;
+}
+
+static void wr_datum(writer *w, gc_handle root) {
+    wr_item item;
+    gc_handle rest;
+
+    wr_push(&w->stack, WR_DATUM, root, 0);
+    while(w->stack.depth) {
+        item = w->stack.items[--w->stack.depth];
+        switch(item.kind) {
+        case WR_DATUM:
+            if(!wr_compound(item.obj)) {
+                wr_atom(w, item.obj);
+            } else if(wr_label(w, item.obj)) {
+                /* Already written */
+            } else if(sc_consp(item.obj)) {
+                wr_bytes(&w->out, "(", 1);
+                wr_push(&w->stack, WR_LIST_REST, item.obj, 0);
+                wr_push(&w->stack, WR_DATUM, sc_car(item.obj), 0);
+            } else {
+                wr_bytes(&w->out, "#(", 2);
+                wr_push(&w->stack, WR_VECTOR_REST, item.obj, 0);
+            }
+            break;
+        case WR_LIST_REST:
+            rest = sc_cdr(item.obj);
+            if(NILP(rest)) {
+                wr_bytes(&w->out, ")", 1);
+            } else if(sc_consp(rest) && !wr_labelled(w, rest)) {
+                wr_bytes(&w->out, " ", 1);
+                wr_push(&w->stack, WR_LIST_REST, rest, 0);
+                wr_push(&w->stack, WR_DATUM, sc_car(rest), 0);
+            } else {
+                wr_bytes(&w->out, " . ", 3);
+                wr_push(&w->stack, WR_CLOSE, NIL, 0);
+                wr_push(&w->stack, WR_DATUM, rest, 0);
+            }
+            break;
+        case WR_VECTOR_REST:
+            if(item.index == sc_vector_len(item.obj)) {
+                wr_bytes(&w->out, ")", 1);
+                break;
+            }
+            if(item.index)
+                wr_bytes(&w->out, " ", 1);
+            wr_push(&w->stack, WR_VECTOR_REST, item.obj, item.index + 1);
+            wr_push(&w->stack, WR_DATUM, sc_vector_ref(item.obj, item.index), 0);
+            break;
+        case WR_CLOSE:
+            wr_bytes(&w->out, ")", 1);
+            break;
+        case WR_VISIT:
+            assert(0);
+        }
+    }
+}
+
+static void wr_run(writer *w, gc_handle v, int flags) {
+    w->flags  = flags;
+    w->labels = 0;
+    sc_graph_table_init(&w->table, WRITER_TABLE_INITIAL);
+    w->stack.size  = WRITER_STACK_INITIAL;
+    w->stack.depth = 0;
+    w->stack.items = malloc(w->stack.size * sizeof(wr_item));
+    assert(w->stack.items);
+
+    wr_find_cycles(w, v);
+    wr_datum(w, v);
+
+    sc_graph_table_free(&w->table);
+    free(w->stack.items);
+}
+
+int sc_write(int fd, gc_handle v, int flags) {
+    char buf[WRITER_BUFFER_SIZE];
+    writer w;
+
+    w.out.buf   = buf;
+    w.out.size  = sizeof(buf);
+    w.out.used  = 0;
+    w.out.total = 0;
+    w.out.fd    = fd;
+    w.out.error = 0;
+
+    wr_run(&w, v, flags);
+    wr_flush(&w.out, w.out.buf, w.out.used);
+
+    if(w.out.error) {
+        errno = w.out.error;
+        return -1;
+    }
+    return 0;
+}
+
+size_t sc_write_to_buffer(char *buf, size_t len, gc_handle v, int flags) {
+    writer w;
+
+    w.out.buf   = buf;
+    w.out.size  = len;
+    w.out.used  = 0;
+    w.out.total = 0;
+    w.out.fd    = -1;
+    w.out.error = 0;
+
+    wr_run(&w, v, flags);
+    if(len)
+        buf[w.out.used] = '\0';
+    return w.out.total;
+}
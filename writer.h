@@ -0,0 +1,31 @@
+#ifndef __FLNV_WRITER_H__
+#define __FLNV_WRITER_H__
+
+#include <stddef.h>
+
+#include "gc.h"
+
+/*
+ * A printer for heap objects. Output is in the syntax the readers
+ * accept, plus #(...) for vectors and \" and \\ escapes in strings, and
+ * goes through a large buffer rather than stdio. Pairs and vectors
+ * that are part of a cycle get datum labels, as in #0=(a b . #0#);
+ * structure that is merely shared is printed in full.
+ *
+ * Writing doesn't allocate, so it never runs the collector.
+ */
+
+/* Write strings and symbols as display does, without quotes */
+#define SC_WRITE_DISPLAY    0x01
+
+/* Write v to fd. Returns 0, or -1 with errno set. */
+int sc_write(int fd, gc_handle v, int flags);
+
+/*
+ * Write v into buf, which holds len bytes, as snprintf does: the text
+ * is truncated to fit and NUL-terminated, and the return value is the
+ * length of the whole text.
+ */
+size_t sc_write_to_buffer(char *buf, size_t len, gc_handle v, int flags);
+
+#endif